@@ -0,0 +1,50 @@
+#!/bin/bash
+# Benchmarks of the interpreter's hot paths
+# Prints one JSON object per workload: operations done, best time in seconds
+# over the runs, operations per second, lval and lenv allocations, and peak RSS
+#
+# ./bench/bench.sh [runs] [workload ...]
+# e.g. ./bench/bench.sh 5 fib lists > baseline.json
+#
+# Each workload bench/<name>.clisp states its number of operations on a
+# '; ops N' line; 'parse' is generated, a large file of definitions to load
+# Set CC, CFLAGS and LIBS to change how the interpreter is built
+
+cd "$(dirname "$0")/.."
+runs=${1:-3}
+shift
+workloads=${@:-"fib ackermann lists arith env parse"}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# Build the latest revision once, optimised
+${CC:-cc} -std=c99 -Wall ${CFLAGS:--O2} functions.c mpc.c ${LIBS:--l edit -l m -l pthread} -o "$tmp/functions" || exit 1
+
+# 20000 lines of definitions, read and evaluated by 'load'
+awk 'BEGIN {
+  for (i = 0; i < 20000; i++) {
+    printf "def {x%d} {%d -%d sym%d {a b {c}} \"str%d\" (+ 1 2)} ; comment\n", i % 100, i, i, i, i
+  }
+}' > "$tmp/parse-data.clisp"
+printf '; ops 20000\nload "%s"\n' "$tmp/parse-data.clisp" > "$tmp/parse.clisp"
+
+for name in $workloads; do
+  file=bench/$name.clisp
+  [ "$name" = parse ] && file=$tmp/parse.clisp
+  ops=$(awk '/^; ops / { print $3; exit }' "$file")
+
+  best=
+  for ((i = 0; i < runs; i++)); do
+    { TIMEFORMAT=%R; time "$tmp/functions" --stats "$file" > /dev/null 2> "$tmp/stats"; } 2> "$tmp/time"
+    t=$(cat "$tmp/time")
+    best=$(awk -v a="$t" -v b="$best" 'BEGIN { print (b == "" || a < b) ? a : b }')
+  done
+
+  # Counters from 'lval_allocs N lenv_allocs N ...' on the last line of stderr
+  tail -n 1 "$tmp/stats" | awk -v name="$name" -v ops="$ops" -v t="$best" '{
+    for (i = 1; i < NF; i += 2) { stat[$i] = $(i + 1) }
+    printf "{\"name\": \"%s\", \"ops\": %d, \"seconds\": %.3f, \"ops_per_sec\": %.0f, ", name, ops, t, (t > 0 ? ops / t : 0)
+    printf "\"lval_allocs\": %d, \"lenv_allocs\": %d, \"peak_rss_kb\": %d}\n", stat["lval_allocs"], stat["lenv_allocs"], stat["peak_rss_kb"]
+  }'
+done
@@ -1,2 +1,2 @@
-cc -std=c99 -Wall $1.c mpc.c -l edit -l m -o $1
+cc -std=c99 -Wall $1.c mpc.c -l edit -l m -l pthread -o $1
 ./$1
\ No newline at end of file
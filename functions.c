@@ -5,10 +5,17 @@
  *  @author Bryan Chun (bryanchun)
  */
 
+/* POSIX and XSI interfaces such as sigaction and setitimer, under -std=c99 */
+#define _XOPEN_SOURCE 700
+
 #include <stdio.h>
 #include <stdlib.h>
 #include "mpc.h"
 #include <math.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
+#include <time.h>
 
 #ifdef _WIN32  // defined(__unix__) || defined(__APPLE__) || defined(__MACH__) || defined(_WIN64)
 #include <string>
@@ -30,10 +37,510 @@ char* readline(char* prompt) {
 void add_history(char* unused) {}
 #else
 #include <editline/readline.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
 #endif
 
 #include "functions.h"
 
+/**
+ * Threads
+ * 
+ * Spawned calls and parallel builtins run Lisp functions on worker
+ * threads, sharing values and environments with the calling thread. Only
+ * while tasks are queued or running are reference counts and counters
+ * updated atomically, see LPAR_ADD, and shared tables locked
+ */
+
+/* Tasks queued or running, see lpar_push, read through LPAR_ACTIVE */
+/* Only a thread running alone may start the first one */
+static int lpar_active = 0;
+
+/* Environment every other descends from, shared by all threads */
+static lenv* lenv_global = NULL;
+
+/* Whether 'def' leaves the global environment alone, see lsrv_run */
+static int lenv_sealed = 0;
+
+#ifndef _WIN32
+/* Guards pool slabs, interned symbols, compiled code and writers of the */
+/* global environment */
+static pthread_mutex_t lpar_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static __thread int lpar_held = 0;    /* Nesting of lpar_lock in this thread */
+static __thread int lpar_locked = 0;  /* Whether the outermost one took the mutex */
+
+void lpar_lock(void) {
+#ifndef _WIN32
+  if (lpar_held++ == 0 && LPAR_ACTIVE()) {
+    pthread_mutex_lock(&lpar_mutex);
+    lpar_locked = 1;
+  }
+#endif
+}
+
+void lpar_unlock(void) {
+#ifndef _WIN32
+  /* Tasks may have finished meanwhile, so unlock whatever was locked */
+  if (--lpar_held == 0 && lpar_locked) {
+    lpar_locked = 0;
+    pthread_mutex_unlock(&lpar_mutex);
+  }
+#endif
+}
+
+/**
+ * Read-Copy-Update
+ * 
+ * Bindings of the global environment are read without locks while tasks
+ * run: 'def' publishes a fresh copy of them, and old copies are freed
+ * once every thread that could still be reading one has moved on
+ */
+
+/* Advanced by each retirement, so readers tell which copies they may see */
+static unsigned long lrcu_epoch = 1;
+
+/* Epoch each thread started reading in, 0 while not reading */
+static lrcu_slot lrcu_slots[LRCU_SLOTS];
+static int lrcu_nslots = 0;
+static __thread int lrcu_self = -1;
+
+/* Copies replaced but maybe still read, newest first */
+static lrcu_node* lrcu_retired = NULL;
+
+int lrcu_enter(lenv* e) {
+  /* Announce reading the bindings of 'e' if other threads may replace them, */
+  /* returning whether it was announced, for lrcu_leave */
+  if (!__atomic_load_n(&e->tab, __ATOMIC_RELAXED) || !LPAR_ACTIVE()) { return 0; }
+  if (lrcu_self < 0) {
+    lrcu_self = __atomic_fetch_add(&lrcu_nslots, 1, __ATOMIC_ACQ_REL);
+    if (lrcu_self >= LRCU_SLOTS) {
+      fprintf(stderr, "More than %i threads reading the environment\n", LRCU_SLOTS);
+      abort();
+    }
+  }
+  /* Writers either see the announcement, or published before it was made */
+  __atomic_store_n(&lrcu_slots[lrcu_self].epoch,
+    __atomic_load_n(&lrcu_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return 1;
+}
+
+void lrcu_leave(int reading) {
+  if (reading) { __atomic_store_n(&lrcu_slots[lrcu_self].epoch, 0, __ATOMIC_RELEASE); }
+}
+
+void lrcu_retire(lenv* t) {
+  /* Free bindings 't', replaced in their environment, once no reader is left */
+  lrcu_node* n = malloc(sizeof(lrcu_node));
+  n->tab = t;
+  n->epoch = __atomic_fetch_add(&lrcu_epoch, 1, __ATOMIC_SEQ_CST);
+  n->next = lrcu_retired;
+  lrcu_retired = n;
+}
+
+void lrcu_reclaim(int all) {
+  /* Free retired bindings no thread may still be reading, or all of them */
+  /* when no other thread runs, with writers locked out */
+  unsigned long oldest = ULONG_MAX;
+  if (!all) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int n = __atomic_load_n(&lrcu_nslots, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n && i < LRCU_SLOTS; i++) {
+      unsigned long r = __atomic_load_n(&lrcu_slots[i].epoch, __ATOMIC_ACQUIRE);
+      if (r && r < oldest) { oldest = r; }
+    }
+  }
+
+  /* Readers that started in an epoch after retirement see the new copy */
+  lrcu_node** p = &lrcu_retired;
+  while (*p) {
+    lrcu_node* n = *p;
+    if (n->epoch < oldest) {
+      *p = n->next;
+      lenv_del(n->tab);
+      free(n);
+    } else {
+      p = &n->next;
+    }
+  }
+}
+
+/**
+ * Pool Allocator
+ * 
+ * lval and lenv headers are carved out of fixed-size slabs and recycled
+ * through per-thread free lists, instead of a malloc/free per node
+ */
+
+/* Every slab ever allocated, walked by the garbage collector */
+static lslab* lpool_slabs = NULL;
+static lenv_slab* lpool_env_slabs = NULL;
+
+/* Free lists of the current thread, with their last nodes */
+static __thread lval* lpool_free = NULL;
+static __thread lval* lpool_free_tail = NULL;
+static __thread lenv* lpool_env_free = NULL;
+static __thread lenv* lpool_env_free_tail = NULL;
+
+/* Free lists handed back by threads going idle, see lpool_return, */
+/* taken whole by the next thread to run out, under lpar_lock */
+static lval* lpool_spare = NULL;
+static lval* lpool_spare_tail = NULL;
+static lenv* lpool_env_spare = NULL;
+static lenv* lpool_env_spare_tail = NULL;
+
+/* Counters reported by the 'pool' builtin */
+static long lgc_live = 0;
+static long lpool_allocs = 0;
+static long lpool_env_live = 0;
+static long lpool_env_allocs = 0;
+static long lpool_nslabs = 0;
+static long lpool_env_nslabs = 0;
+
+void lpool_refill(void) {
+  /* Out of free nodes: take the spare ones, else thread a new slab */
+  lpar_lock();
+  if (lpool_spare) {
+    lpool_free = lpool_spare;
+    lpool_free_tail = lpool_spare_tail;
+    lpool_spare = NULL;
+    lpar_unlock();
+    return;
+  }
+  lslab* s = malloc(sizeof(lslab));
+  s->next = lpool_slabs;
+  lpool_slabs = s;
+  lpool_nslabs++;
+  lpar_unlock();
+
+  lpool_free_tail = &s->vals[LPOOL_SLAB - 1];
+  for (int i = LPOOL_SLAB - 1; i >= 0; i--) {
+    s->vals[i].ref = 0;
+    s->vals[i].next_free = lpool_free;
+    lpool_free = &s->vals[i];
+  }
+}
+
+lval* lval_alloc(void) {
+  if (!lpool_free) { lpool_refill(); }
+
+  lval* v = lpool_free;
+  lpool_free = v->next_free;
+  LPAR_ADD(lgc_live, 1);
+  LPAR_ADD(lpool_allocs, 1);
+  LMEM_COUNT(LMEM_LVAL, sizeof(lval));
+  return v;
+}
+
+void lval_free(lval* v) {
+  /* A zero reference count marks the slot as free for the collector */
+  v->ref = 0;
+  if (!lpool_free) { lpool_free_tail = v; }
+  v->next_free = lpool_free;
+  lpool_free = v;
+  LPAR_ADD(lgc_live, -1);
+}
+
+void lpool_env_refill(void) {
+  lpar_lock();
+  if (lpool_env_spare) {
+    lpool_env_free = lpool_env_spare;
+    lpool_env_free_tail = lpool_env_spare_tail;
+    lpool_env_spare = NULL;
+    lpar_unlock();
+    return;
+  }
+  lenv_slab* s = malloc(sizeof(lenv_slab));
+  s->next = lpool_env_slabs;
+  lpool_env_slabs = s;
+  lpool_env_nslabs++;
+  lpar_unlock();
+
+  lpool_env_free_tail = &s->envs[LPOOL_SLAB - 1];
+  for (int i = LPOOL_SLAB - 1; i >= 0; i--) {
+    /* Free lenvs are linked through their parent pointer */
+    s->envs[i].par = lpool_env_free;
+    lpool_env_free = &s->envs[i];
+  }
+}
+
+lenv* lenv_alloc(void) {
+  if (!lpool_env_free) { lpool_env_refill(); }
+
+  lenv* e = lpool_env_free;
+  lpool_env_free = e->par;
+  LPAR_ADD(lpool_env_live, 1);
+  LPAR_ADD(lpool_env_allocs, 1);
+  LMEM_COUNT(LMEM_LENV, sizeof(lenv));
+  return e;
+}
+
+void lenv_free(lenv* e) {
+  if (!lpool_env_free) { lpool_env_free_tail = e; }
+  e->par = lpool_env_free;
+  lpool_env_free = e;
+  LPAR_ADD(lpool_env_live, -1);
+}
+
+void lpool_return(void) {
+  /* Hand the free lists of this thread to whichever thread runs out next, */
+  /* so nodes freed by one thread are not stranded from the others */
+  lpar_lock();
+  if (lpool_free) {
+    lpool_free_tail->next_free = lpool_spare;
+    if (!lpool_spare) { lpool_spare_tail = lpool_free_tail; }
+    lpool_spare = lpool_free;
+    lpool_free = NULL;
+  }
+  if (lpool_env_free) {
+    lpool_env_free_tail->par = lpool_env_spare;
+    if (!lpool_env_spare) { lpool_env_spare_tail = lpool_env_free_tail; }
+    lpool_env_spare = lpool_env_free;
+    lpool_env_free = NULL;
+  }
+  lpar_unlock();
+}
+
+/**
+ * Memory Accounting
+ * 
+ * Live objects by type are counted by walking the pool slabs when asked
+ * With -DLMEM_STATS, every allocation is also counted by call site, along
+ * with the peak number of live objects
+ */
+
+#ifdef LMEM_STATS
+static char* lmem_sites[LMEM_NSITES] = {
+  "lval_alloc", "lenv_alloc", "lval_reserve", "lval_copy", "lenv_copy",
+  "lval_err", "lval_str", "lenv_put", "lsym_intern", "lchunk_emit"
+};
+#endif
+static long lmem_calls[LMEM_NSITES];
+static long lmem_bytes[LMEM_NSITES];
+static long lmem_peak = 0;
+static long lmem_env_peak = 0;
+
+/* Allocations and CPU time when last reported, for the recent rate */
+static long lmem_last_allocs = 0;
+static clock_t lmem_last_clock = 0;
+
+void lmem_count(int site, long bytes) {
+  LPAR_ADD(lmem_calls[site], 1);
+  LPAR_ADD(lmem_bytes[site], bytes);
+  if (lgc_live > lmem_peak) { lmem_peak = lgc_live; }
+  if (lpool_env_live > lmem_env_peak) { lmem_env_peak = lpool_env_live; }
+}
+
+void lmem_live(long* counts) {
+  /* Live lvals by type, immediate numbers taking no slot */
+  for (int t = 0; t <= LVAL_TERM; t++) { counts[t] = 0; }
+  for (lslab* s = lpool_slabs; s; s = s->next) {
+    for (int i = 0; i < LPOOL_SLAB; i++) {
+      if (s->vals[i].ref > 0) { counts[s->vals[i].type]++; }
+    }
+  }
+}
+
+void lmem_print(FILE* f) {
+  /* Live objects, peaks and allocation rates, then allocations by site */
+  long counts[LVAL_TERM + 1];
+  lmem_live(counts);
+
+  clock_t now = clock();
+  double total = (double)now / CLOCKS_PER_SEC;
+  double recent = (double)(now - lmem_last_clock) / CLOCKS_PER_SEC;
+  fprintf(f, "lval \tlive %li \t", lgc_live);
+#ifdef LMEM_STATS
+  fprintf(f, "peak %li \t", lmem_peak);
+#endif
+  fprintf(f, "allocs %li \t(%.0f/s, %.0f/s since last)\n", lpool_allocs,
+    total > 0 ? lpool_allocs / total : 0,
+    recent > 0 ? (lpool_allocs - lmem_last_allocs) / recent : 0);
+  for (int t = 0; t <= LVAL_TERM; t++) {
+    if (counts[t]) { fprintf(f, "  %s \t%li\n", ltype_name(t), counts[t]); }
+  }
+  fprintf(f, "lenv \tlive %li \t", lpool_env_live);
+#ifdef LMEM_STATS
+  fprintf(f, "peak %li \t", lmem_env_peak);
+#endif
+  fprintf(f, "allocs %li\n", lpool_env_allocs);
+  fprintf(f, "pool \t%li bytes of lval slabs \t%li bytes of lenv slabs\n",
+    lpool_nslabs * (long)sizeof(lslab), lpool_env_nslabs * (long)sizeof(lenv_slab));
+  lmem_last_allocs = lpool_allocs;
+  lmem_last_clock = now;
+
+#ifdef LMEM_STATS
+  /* Every pool header and list cell is counted at lval_alloc, lenv_alloc */
+  /* and lval_reserve, so those overlap the sites that call them */
+  fprintf(f, "site \tcalls \tbytes\n");
+  for (int i = 0; i < LMEM_NSITES; i++) {
+    fprintf(f, "  %s \t%li \t%li\n", lmem_sites[i], lmem_calls[i], lmem_bytes[i]);
+  }
+#else
+  fprintf(f, "(peaks and allocations by site need -DLMEM_STATS)\n");
+#endif
+}
+
+void lmem_leaks(FILE* f) {
+  /* Objects still live once everything has been released */
+  if (lgc_live == 0 && lpool_env_live == 0) { return; }
+  long counts[LVAL_TERM + 1];
+  lmem_live(counts);
+
+  fprintf(f, "leaked \t%li lval \t%li lenv\n", lgc_live, lpool_env_live);
+  for (int t = 0; t <= LVAL_TERM; t++) {
+    if (counts[t]) { fprintf(f, "  %s \t%li\n", ltype_name(t), counts[t]); }
+  }
+}
+
+/**
+ * Garbage Collector
+ * 
+ * Values are reclaimed by reference counting in lval_del, which cannot
+ * free cycles of references. Walking the pool slabs reaches every lval,
+ * so a mark-and-sweep pass can find and free unreachable cycles.
+ * Roots are whatever references the heap itself does not account for:
+ * the global lenv, the virtual machine stack and evaluator locals.
+ */
+
+/* Collect once 'lgc_live' passes the threshold, then set it to LGC_GROWTH */
+/* times what survived, but never below 'lgc_minimum' */
+static long lgc_minimum = LGC_MINIMUM;
+static long lgc_threshold = LGC_MINIMUM;
+static long lgc_collections = 0;
+static long lgc_freed = 0;
+
+/* Explicit mark stack, so deep structures do not recurse on the C stack */
+static int lgc_count = 0;
+static int lgc_capacity = 0;
+static lval** lgc_stack = NULL;
+
+void lgc_each(void (*fn)(lval*)) {
+  /* Apply 'fn' to every lval in use */
+  for (lslab* s = lpool_slabs; s; s = s->next) {
+    for (int i = 0; i < LPOOL_SLAB; i++) {
+      if (s->vals[i].ref > 0) { fn(&s->vals[i]); }
+    }
+  }
+}
+
+void lgc_visit(lval* v, void (*fn)(lval*)) {
+  /* Apply 'fn' to every lval 'v' holds a counted reference to */
+  /* References held by compiled code are not visited, so they act as roots */
+  /* Immediate numbers are not on the heap, so are skipped too */
+  switch (v->type) {
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) {
+        /* Cells handed over for evaluation are left empty */
+        if (v->cell[i] && !LFIX_P(v->cell[i])) { fn(v->cell[i]); }
+      }
+      break;
+
+    case LVAL_FUN:
+      if (!v->builtin) {
+        for (int i = 0; i < v->env->count; i++) {
+          if (!LFIX_P(v->env->vals[i])) { fn(v->env->vals[i]); }
+        }
+        fn(v->formals);
+        fn(v->body);
+        if (v->cap) { fn(v->cap); }
+      }
+      break;
+
+    /* Collections wait for tasks, so futures are done by then */
+    case LVAL_FUT:
+      if (v->value && !LFIX_P(v->value)) { fn(v->value); }
+      break;
+  }
+}
+
+void lgc_unref(lval* v) { v->gc_ref--; }
+
+void lgc_mark(lval* v) {
+  if (v->gc_ref == LGC_MARKED) { return; }
+  v->gc_ref = LGC_MARKED;
+  if (lgc_count == lgc_capacity) {
+    lgc_capacity = lgc_capacity ? lgc_capacity * 2 : 256;
+    lgc_stack = realloc(lgc_stack, sizeof(lval*) * lgc_capacity);
+  }
+  lgc_stack[lgc_count++] = v;
+}
+
+void lgc_release(lval* v) {
+  /* Drop a reference from garbage to a surviving value */
+  if (v->gc_ref == LGC_MARKED) { lval_del(v); }
+}
+
+void lgc_count_refs(lval* v) { v->gc_ref = v->ref; }
+void lgc_subtract(lval* v) { lgc_visit(v, lgc_unref); }
+void lgc_mark_root(lval* v) { if (v->gc_ref > 0) { lgc_mark(v); } }
+
+void lgc_sweep(lval* v) {
+  /* Release what garbage holds besides other garbage */
+  if (v->gc_ref == LGC_MARKED) { return; }
+  lgc_visit(v, lgc_release);
+  switch (v->type) {
+    case LVAL_ERR: free(v->err); break;
+    case LVAL_STR: free(v->str); break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      free(v->cell - v->offset);
+      if (v->code) { lchunk_del(v->code); }
+      break;
+    case LVAL_FUN:
+      if (!v->builtin) {
+        free(v->env->syms);  free(v->env->vals);
+        free(v->env->index); lenv_free(v->env);
+      }
+      break;
+  }
+}
+
+static long lgc_swept = 0;
+void lgc_free(lval* v) {
+  if (v->gc_ref != LGC_MARKED) { lval_free(v); lgc_swept++; }
+}
+
+long lgc_collect(void) {
+  /* Count references from within the heap, leaving only root references */
+  lgc_each(lgc_count_refs);
+  lgc_each(lgc_subtract);
+
+  /* Mark everything reachable from a root */
+  lgc_each(lgc_mark_root);
+  while (lgc_count) { lgc_visit(lgc_stack[--lgc_count], lgc_mark); }
+
+  /* Sweep the unmarked, then free the garbage itself */
+  lgc_each(lgc_sweep);
+  lgc_swept = 0;
+  lgc_each(lgc_free);
+
+  lgc_collections++;
+  lgc_freed += lgc_swept;
+  lgc_threshold = lgc_live * LGC_GROWTH;
+  if (lgc_threshold < lgc_minimum) { lgc_threshold = lgc_minimum; }
+  return lgc_swept;
+}
+
+void lgc_safepoint(void) {
+  /* Collect once 'lgc_live' has passed the threshold, called by the */
+  /* evaluator before each call, where everything it holds is counted */
+  /* Not while worker threads share the heap, the next call retrying */
+  if (LPAR_ACTIVE()) { return; }
+  lgc_collect();
+}
+
 /**
  * Constructors and Destructor 
  * 
@@ -41,7 +548,11 @@ void add_history(char* unused) {}
 
 /* Constructor (generator) for number-type lval */
 lval* lval_num(long x) {
-  lval* v = malloc(sizeof(lval));
+  /* Small numbers need no heap node at all */
+  if (x >= LFIX_MIN && x <= LFIX_MAX) { return LFIX(x); }
+
+  lval* v = lval_alloc();
+  v->ref = 1;
   v->type = LVAL_NUM;
   v->num = x;
   return v;
@@ -50,7 +561,8 @@ lval* lval_num(long x) {
 /* Constructor (generator) for error-type lval */
 /* Error as first class citizen, for expression and error propagation */
 lval* lval_err(char* fmt, ...) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
+  v->ref = 1;
   v->type = LVAL_ERR;
 
   /* Create and Initialise a 'va_list' */
@@ -65,6 +577,7 @@ lval* lval_err(char* fmt, ...) {
 
   /* Reallocate error string to required number of bytes */
   v->err = realloc(v->err, strlen(v->err) + 1);
+  LMEM_COUNT(LMEM_ERR, sizeof(lval) + strlen(v->err) + 1);
 
   /* Clean up 'va_list' */
   va_end(va);
@@ -74,59 +587,99 @@ lval* lval_err(char* fmt, ...) {
 
 /* Constructor (generator) for symbol-type lval */
 lval* lval_sym(char* s) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
+  v->ref = 1;
   v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);   // for accommodating terminating '\0'
-  // BUG: v->err gives rise to freeing un-malloced memory
-  strcpy(v->sym, s);
+  /* Share the one interned copy of the name */
+  v->sym = lsym_intern(s);
+  return v;
+}
+
+/* Constructor (generator) for string-type lval */
+lval* lval_str(char* s) {
+  lval* v = lval_alloc();
+  v->ref = 1;
+  v->type = LVAL_STR;
+  v->str = malloc(strlen(s) + 1);
+  strcpy(v->str, s);
+  LMEM_COUNT(LMEM_STR, sizeof(lval) + strlen(s) + 1);
   return v;
 }
 
 /* Constructor (generator) for sexpr-type lval */
 lval* lval_sexpr(void) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
+  v->ref = 1;
   v->type = LVAL_SEXPR;
   v->count = 0;
+  v->capacity = 0;
+  v->offset = 0;
   v->cell = NULL;
+  v->code = NULL;
   return v;
 }
 
 lval* lval_qexpr(void) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
+  v->ref = 1;
   v->type = LVAL_QEXPR;
   v->count = 0;
+  v->capacity = 0;
+  v->offset = 0;
   v->cell = NULL;
+  v->code = NULL;
   return v;
 }
 
 lval* lval_builtin(lbuiltin func) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
+  v->ref = 1;
   v->type = LVAL_FUN;
   v->builtin = func;
   return v;
 }
 
 lval* lval_lambda(lval* formals, lval* body) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
+  v->ref = 1;
   v->type = LVAL_FUN;
 
   /* User_def_fun: set builtin to NULL */
   v->builtin = NULL;
   /* Build new environment */
   v->env = lenv_new();
+  v->cap = NULL;
   /* Set passed formals and body */
   v->formals = formals;
   v->body = body;
+  /* Formals shadow any pure builtin of that name in calls from the body */
+  for (int i = 0; i < formals->count; i++) {
+    if (LTYPE(formals->cell[i]) == LVAL_SYM) { lfold_bind(formals->cell[i]->sym, NULL); }
+  }
+  /* Compile body once here rather than re-walking it on every call */
+  lval_compile_in(v->body, v->formals);
 
   return v;
 }
 
 lval* lval_term(void) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
+  v->ref = 1;
   v->type = LVAL_TERM;
   return v;
 }
 
+lval* lval_future(lval* call) {
+  /* Future of applying the head of S-Expression 'call' to the rest, see 'spawn' */
+  lval* v = lval_alloc();
+  v->ref = 1;
+  v->type = LVAL_FUT;
+  v->call = call;
+  v->value = NULL;
+  v->pending = 1;
+  return v;
+}
+
 char* ltype_name(int t) {
   /* Convert Enum LVAL types to proper strings */
   switch (t) {
@@ -134,29 +687,58 @@ char* ltype_name(int t) {
     case LVAL_NUM:    return "Number";
     case LVAL_ERR:    return "Error";
     case LVAL_SYM:    return "Symbol";
+    case LVAL_STR:    return "String";
     case LVAL_SEXPR:  return "S-Expression";
     case LVAL_QEXPR:  return "Q-Expression";
+    case LVAL_FUT:    return "Future";
     default:          return "Unknown";
   }
 }
 
-/* Free memory of each subtypes of lval */
+/* Values of this thread waiting to be destroyed, so freeing deep */
+/* structures does not recurse on the C stack, see lval_del */
+static __thread int ldel_count = 0;
+static __thread int ldel_capacity = 0;
+static __thread lval** ldel_stack = NULL;
+static __thread int ldel_draining = 0;
+
+/* Release a reference to 'v', freeing memory of each subtypes of lval with the last */
 void lval_del(lval* v) {
+  if (LFIX_P(v)) { return; }
+  if (LPAR_ADD(v->ref, -1) > 0) { return; }
+
+  if (ldel_count == ldel_capacity) {
+    ldel_capacity = ldel_capacity ? ldel_capacity * 2 : 64;
+    ldel_stack = realloc(ldel_stack, sizeof(lval*) * ldel_capacity);
+  }
+  ldel_stack[ldel_count++] = v;
+
+  /* Values released while destroying are left to the outermost call */
+  if (ldel_draining) { return; }
+  ldel_draining = 1;
+  while (ldel_count) { lval_destroy(ldel_stack[--ldel_count]); }
+  ldel_draining = 0;
+}
+
+/* Free 'v' once its last reference is gone, releasing what it holds */
+void lval_destroy(lval* v) {
   switch (v->type) {
     case LVAL_NUM:    break;
 
-    /* Free the error and symbol string memories */
+    /* Free the error string memory, symbols are owned by the intern table */
     case LVAL_ERR:    free(v->err);   break;
-    case LVAL_SYM:    free(v->sym);   break;
+    case LVAL_STR:    free(v->str);   break;
+    case LVAL_SYM:    break;
 
     /* For both SEXPR and QEXPR delete all elements inside */
     case LVAL_SEXPR:
     case LVAL_QEXPR:
       for (int i = 0; i < v->count; i++) {
-        /* Recursively lval_del memories from all s/q-expressions */
+        /* Release memories from all s/q-expressions, see lval_del */
         lval_del(v->cell[i]);
       }
-      free(v->cell);
+      free(v->cell - v->offset);
+      if (v->code) { lchunk_del(v->code); }
       break;
     
     case LVAL_FUN:
@@ -164,101 +746,294 @@ void lval_del(lval* v) {
         lenv_del(v->env);
         lval_del(v->formals);
         lval_del(v->body);
+        if (v->cap) { lval_del(v->cap); }
       }
       break;
+
+    /* A pending future is held by its task, so only one of these is left */
+    case LVAL_FUT:
+      if (v->call) { lval_del(v->call); }
+      if (v->value) { lval_del(v->value); }
+      break;
   }
   /* Free itself always */
-  free(v);
+  lval_free(v);
+}
+
+/**
+ * Symbol Interning
+ * 
+ * Every symbol name is stored once, so environments can hash and compare
+ * symbols by pointer rather than by string
+ */
+
+/* Open-addressing set of interned names, a power of two in size */
+static int lsym_count = 0;
+static int lsym_capacity = 0;
+static char** lsym_table = NULL;
+
+/* Hash of an interned name is taken from its address */
+#define LSYM_HASH(s) ((unsigned long)(((uintptr_t)(s) >> 3) * 2654435761u))
+
+unsigned long lsym_hash(char* s, int n) {
+  /* FNV-1a over the first 'n' characters */
+  unsigned long h = 2166136261u;
+  for (int i = 0; i < n; i++) { h = (h ^ (unsigned char)s[i]) * 16777619u; }
+  return h;
+}
+
+char* lsym_intern(char* s) {
+  return lsym_intern_n(s, strlen(s));
+}
+
+char* lsym_intern_n(char* s, int n) {
+  /* Intern the 'n' characters at 's', which need not be terminated */
+  lpar_lock();
+  char* sym = lsym_insert(s, n);
+  lpar_unlock();
+  return sym;
+}
+
+char* lsym_insert(char* s, int n) {
+  /* Find or add the 'n' characters at 's', with the table locked */
+  /* Grow at half load, rehashing existing names */
+  if ((lsym_count + 1) * 2 > lsym_capacity) {
+    int capacity = lsym_capacity ? lsym_capacity * 2 : 256;
+    char** table = calloc(capacity, sizeof(char*));
+    for (int i = 0; i < lsym_capacity; i++) {
+      if (!lsym_table[i]) { continue; }
+      unsigned long h = lsym_hash(lsym_table[i], strlen(lsym_table[i])) & (capacity - 1);
+      while (table[h]) { h = (h + 1) & (capacity - 1); }
+      table[h] = lsym_table[i];
+    }
+    free(lsym_table);
+    lsym_table = table;
+    lsym_capacity = capacity;
+  }
+
+  /* Linear probe until found or an empty slot */
+  unsigned long h = lsym_hash(s, n) & (lsym_capacity - 1);
+  while (lsym_table[h]) {
+    if (strncmp(lsym_table[h], s, n) == 0 && lsym_table[h][n] == '\0') {
+      return lsym_table[h];
+    }
+    h = (h + 1) & (lsym_capacity - 1);
+  }
+
+  /* Only copy names never seen before */
+  lsym_table[h] = malloc(n + 1);   // for accommodating terminating '\0'
+  LMEM_COUNT(LMEM_SYM, n + 1);
+  memcpy(lsym_table[h], s, n);
+  lsym_table[h][n] = '\0';
+  lsym_count++;
+  return lsym_table[h];
 }
 
 lenv* lenv_new(void) {
-  lenv* e = malloc(sizeof(lenv));
+  lenv* e = lenv_alloc();
   e->par = NULL;
+  e->up = NULL;
+  e->tab = NULL;
   e->count = 0;
   e->syms = NULL;
   e->vals = NULL;
+  e->capacity = 0;
+  e->index = NULL;
   return e;
 }
 
 void lenv_del(lenv* e) {
-  /* Free syms and lval_del vals recursively */
+  /* lval_del vals recursively, syms belong to the intern table */
   for (int i = 0; i < e->count; i++) {
-    free(e->syms[i]);
     lval_del(e->vals[i]);
   }
   free(e->syms);
   free(e->vals);
-  free(e);
+  free(e->index);
+  /* Bindings of the global environment go with it, no thread being left */
+  if (e->tab) {
+    lrcu_reclaim(1);
+    lenv_del(e->tab);
+  }
+  lenv_free(e);
   /* Do not delete parent envs */
 }
 
+int lenv_slot(lenv* e, char* sym) {
+  /* Index slot holding interned 'sym', or the empty slot it would take */
+  unsigned long mask = e->capacity - 1;
+  unsigned long h = LSYM_HASH(sym) & mask;
+  while (e->index[h] && e->syms[e->index[h] - 1] != sym) {
+    h = (h + 1) & mask;
+  }
+  return h;
+}
+
+lval* lenv_find(lenv* e, char* sym) {
+  /* Value bound to interned 'sym' in 'e' or the frames it captured, */
+  /* not looking into enclosing scopes, else NULL */
+  for (; e; e = e->up) {
+    if (e->capacity == 0) { continue; }
+    int i = e->index[lenv_slot(e, sym)];
+    if (i) { return e->vals[i - 1]; }
+  }
+  return NULL;
+}
+
 lval* lenv_get(lenv* e, lval* k) {
 
-  /* Lookup 'k' in 'syms' */
-  for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      /* Return copy of the 'sym' from 'e' */
-      return lval_copy(e->vals[i]);
-    }
+  /* Lookup 'k' in 'syms' and the frames captured by each scope, */
+  /* flooding into enclosing scopes */
+  for (; e->par; e = e->par) {
+    lval* v = lenv_find(e, k->sym);
+    /* Return shared reference to the value of 'sym' */
+    if (v) { return lval_retain(v); }
   }
 
-  /* If there is parent scope, flood into enclosing scope */
+  /* Then the outermost, whose bindings other threads may be replacing */
+  int reading = lrcu_enter(e);
+  lval* v = lenv_find(lenv_table(e), k->sym);
+  if (v) { v = lval_retain(v); }
+  lrcu_leave(reading);
+
   /* Otherwise cannot find */
-  if (e->par) {
-    return lenv_get(e->par, k);
-  } else {
-    return lval_err("unbound symbol '%s'", k->sym);
+  return v ? v : lval_err("unbound symbol '%s'", k->sym);
+}
+
+int lenv_has(lenv* e, char* sym) {
+  /* Whether interned 'sym' is bound in 'e' or the frames it captured, */
+  /* not looking into enclosing scopes */
+  for (; e; e = e->up) {
+    if (e->capacity && e->index[lenv_slot(e, sym)]) { return 1; }
   }
+  return 0;
 }
 
 void lenv_put(lenv* e, lval* k, lval* v) {
   /* Put variable defintion into deepest, local env */
+  if (__atomic_load_n(&e->tab, __ATOMIC_RELAXED)) {
+    lenv_publish(e, k, v);
+  } else {
+    lenv_set(e, k, v);
+  }
+}
+
+void lenv_set(lenv* e, lval* k, lval* v) {
+  /* Bind 'k' to 'v' in the bindings of 'e' itself, which no other thread reads */
 
   /* Lookup if 'k' in 'syms' */
-  for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      /* If 'sym' is found, delete 'e''s copy, write in supplied 'k''s copy */
-      lval_del(e->vals[i]);
-      e->vals[i] = lval_copy(v);
+  if (e->capacity) {
+    int i = e->index[lenv_slot(e, k->sym)];
+    if (i) {
+      /* If 'sym' is found, release 'e''s value, share supplied 'v' */
+      lval_del(e->vals[i - 1]);
+      e->vals[i - 1] = lval_retain(v);
       return;
     }
   }
 
   /* Otherwise allocate new memory for new entry */
+  LMEM_COUNT(LMEM_BIND, sizeof(char*) + sizeof(lval*));
   e->count++;
   e->vals = realloc(e->vals, sizeof(lval*) * e->count);
   e->syms = realloc(e->syms, sizeof(char*) * e->count);
 
-  /* Copy contents to newly allocated memory */
-  e->vals[e->count - 1] = lval_copy(v);
-  e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-  strcpy(e->syms[e->count - 1], k->sym);
+  /* Share value and name in newly allocated memory */
+  e->vals[e->count - 1] = lval_retain(v);
+  e->syms[e->count - 1] = k->sym;
+
+  /* Keep the index at most half full, rebuilding it on growth */
+  if (e->count * 2 > e->capacity) {
+    free(e->index);
+    e->capacity = e->capacity ? e->capacity * 2 : 8;
+    e->index = calloc(e->capacity, sizeof(int));
+    for (int i = 0; i < e->count; i++) {
+      e->index[lenv_slot(e, e->syms[i])] = i + 1;
+    }
+  } else {
+    e->index[lenv_slot(e, k->sym)] = e->count;
+  }
+}
+
+lenv* lenv_outer(lenv* e) {
+  /* Traverse to the parent env where there are no more grand-parents, */
+  /* stopping short of the global env once it is sealed */
+  while (e->par && !(lenv_sealed && e->par == lenv_global)) { e = e->par; }
+  return e;
 }
 
 void lenv_def(lenv* e, lval* k, lval* v) {
   /* Put variable defintion into shallowest, global env */
-
-  /* Traverse to the parent env where there are no more grand-parents */
-  while(e->par) { e = e->par; }
   /* Perform ordinary put in outermost 'e' */
-  lenv_put(e, k, v);
+  lenv_put(lenv_outer(e), k, v);
 }
 
 lenv* lenv_copy(lenv* e) {
-  lenv* n = malloc(sizeof(lenv));
+  LMEM_COUNT(LMEM_ENV_COPY, sizeof(lenv)
+    + (sizeof(char*) + sizeof(lval*)) * e->count + sizeof(int) * e->capacity);
+  lenv* n = lenv_alloc();
   n->par = e->par;
+  n->up = e->up;
+  n->tab = NULL;
   n->count = e->count;
   n->syms = malloc(sizeof(char*) * n->count);
   n->vals = malloc(sizeof(lval*) * n->count);
   for (int i = 0; i < n->count; i++) {
-    n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-    strcpy(n->syms[i], e->syms[i]);
-    n->vals[i] = lval_copy(e->vals[i]);
+    n->syms[i] = e->syms[i];
+    n->vals[i] = lval_retain(e->vals[i]);
+  }
+  /* Interned names hash the same, so the index carries over as is */
+  n->capacity = e->capacity;
+  n->index = NULL;
+  if (n->capacity) {
+    n->index = malloc(sizeof(int) * n->capacity);
+    memcpy(n->index, e->index, sizeof(int) * n->capacity);
   }
   return n;
 }
 
+void lenv_share(lenv* e) {
+  /* Make empty 'e' the global environment, its bindings kept in 'tab' */
+  /* so threads can read them while 'def' replaces them */
+  e->tab = lenv_new();
+  lenv_global = e;
+}
+
+lenv* lenv_table(lenv* e) {
+  /* Current bindings of 'e' */
+  lenv* t = __atomic_load_n(&e->tab, __ATOMIC_ACQUIRE);
+  return t ? t : e;
+}
+
+void lenv_publish(lenv* e, lval* k, lval* v) {
+  /* Bind 'k' to 'v' in the shared bindings of 'e' */
+  /* While tasks run, these are copied with the change and swapped in */
+  /* atomically, readers of the old copy being left to finish */
+  lpar_lock();
+  if (!LPAR_ACTIVE()) {
+    lenv_set(e->tab, k, v);
+    lrcu_reclaim(1);
+  } else {
+    lenv* t = e->tab;
+    lenv* n = lenv_copy(t);
+    lenv_set(n, k, v);
+    __atomic_store_n(&e->tab, n, __ATOMIC_RELEASE);
+    lrcu_retire(t);
+    lrcu_reclaim(0);
+  }
+  lpar_unlock();
+}
+
+lenv* lenv_snapshot(lenv* e) {
+  /* Copy of the bindings of 'e' as they are now */
+  int reading = lrcu_enter(e);
+  lenv* x = lenv_copy(lenv_table(e));
+  lrcu_leave(reading);
+  return x;
+}
+
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
+  lbuiltin_register(name, func);
   lval* k = lval_sym(name);
   lval* f = lval_builtin(func);
   lenv_put(e, k, f);
@@ -275,6 +1050,15 @@ void lenv_add_builtins(lenv* e) {
   lenv_add_builtin(e, "=", builtin_put);
   lenv_add_builtin(e, "exit", builtin_exit);
   lenv_add_builtin(e, "env", builtin_env);
+  lenv_add_builtin(e, "gc", builtin_gc);
+  lenv_add_builtin(e, "pool", builtin_pool);
+  lenv_add_builtin(e, "mem-stats", builtin_mem_stats);
+  lenv_add_builtin(e, "max-depth", builtin_max_depth);
+  lenv_add_builtin(e, "load", builtin_load);
+  lenv_add_builtin(e, "print", builtin_print);
+  lenv_add_builtin(e, "save-image", builtin_save_image);
+  lenv_add_builtin(e, "serialize", builtin_serialize);
+  lenv_add_builtin(e, "deserialize", builtin_deserialize);
 
   /* List Functions */
   lenv_add_builtin(e, "head", builtin_head);
@@ -285,6 +1069,11 @@ void lenv_add_builtins(lenv* e) {
   lenv_add_builtin(e, "cons", builtin_cons);
   lenv_add_builtin(e, "len", builtin_len);
   lenv_add_builtin(e, "init", builtin_init);
+  lenv_add_builtin(e, "pmap", builtin_pmap);
+  lenv_add_builtin(e, "pfilter", builtin_pfilter);
+  lenv_add_builtin(e, "preduce", builtin_preduce);
+  lenv_add_builtin(e, "spawn", builtin_spawn);
+  lenv_add_builtin(e, "await", builtin_await);
 
   /* Mathematical Functions */
   lenv_add_builtin(e, "+", builtin_add);
@@ -311,6 +1100,7 @@ void lenv_add_builtins(lenv* e) {
  * 
  */
 
+/* Reading through the mpc grammar is kept for debugging, see '--mpc' */
 lval* lval_read_num(mpc_ast_t* t) {
   /* Safely convert string to number */
   errno = 0;    // external flag for strtol
@@ -320,12 +1110,35 @@ lval* lval_read_num(mpc_ast_t* t) {
     : lval_err("invalid number");
 }
 
+void lval_reserve(lval* v, int n) {
+  /* Ensure room for 'n' more cells after the last, 'v' is unshared */
+  if (v->offset + v->count + n <= v->capacity) { return; }
+  lval** base = v->cell - v->offset;
+
+  /* Reclaim the head left by popping once it is at least half of the space */
+  if (v->offset && v->offset >= v->count) {
+    if (v->count) { memmove(base, v->cell, sizeof(lval*) * v->count); }
+    v->offset = 0;
+  }
+
+  /* Otherwise grow geometrically, so appends are amortized O(1) */
+  if (v->offset + v->count + n > v->capacity) {
+    int capacity = v->capacity ? v->capacity : 4;
+    while (capacity < v->offset + v->count + n) { capacity *= 2; }
+    LMEM_COUNT(LMEM_CELLS, sizeof(lval*) * (capacity - v->capacity));
+    base = realloc(base, sizeof(lval*) * capacity);
+    v->capacity = capacity;
+  }
+  v->cell = base + v->offset;
+}
+
 lval* lval_add(lval* v, lval* x) {
   /* Effect: Preserve 'v' and 'x' without deallocation */
-  v->count++;
-  /* Increment memory on-demand by realloc */
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-  v->cell[v->count - 1] = x;
+  v = lval_own(v);
+  lval_uncompile(v);
+  /* Increment memory on-demand */
+  lval_reserve(v, 1);
+  v->cell[v->count++] = x;
   return v;
 }
 
@@ -353,72 +1166,380 @@ lval* lval_read(mpc_ast_t* t) {
   return x;
 }
 
-/**
- * Printers
- * 
- */
-
-/* Print an s-expression */
-/* Done recursively when lval_print calls lval_expr_print again */
-void lval_expr_print(lval* v, char open, char close) {
-  putchar(open);
-  for (int i = 0; i < v->count; i++) {
-    /* Print each lval contained within */
-    lval_print(v->cell[i]);
+/* Characters of a symbol, as in the grammar */
+#define LREAD_SYMBOL_CHARS \
+  "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_+-*/\\=<>!&^%"
 
-    /* Print seperating space only for non-last lvals */
-    if (i != (v->count - 1)) {
-      putchar(' ');
-    }
-  }
-  putchar(close);
+int lread_symbol_char(char c) {
+  return c != '\0' && strchr(LREAD_SYMBOL_CHARS, c) != NULL;
 }
 
-/* Print an lval value */
-void lval_print(lval* v) {
-  switch (v->type) {
-    case LVAL_NUM:    printf("%li", v->num);            break;
-    case LVAL_ERR:    printf("Error: %s", v->err);      break;
-    case LVAL_SYM:    printf("%s", v->sym);             break;
-    case LVAL_SEXPR:  lval_expr_print(v, '(', ')');     break;
-    case LVAL_QEXPR:  lval_expr_print(v, '{', '}');     break;
-    case LVAL_FUN:
-      if (v->builtin) {
-        printf("<builtin>");
-      } else {
-        putchar('(');
-        printf("\\ "); lval_print(v->formals);
-        putchar(' '); lval_print(v->body);
-        putchar(')');
-      }
-      break;
-    case LVAL_TERM:   printf("<termination>");          break;
+lval* lval_read_err(char* name, char* src, char* end, char* p, char* msg) {
+  /* Error at 'p' reported by line and column */
+  int line = 1, col = 1;
+  for (char* c = src; c < p; c++) {
+    if (*c == '\n') { line++; col = 1; } else { col++; }
+  }
+  if (p < end) {
+    return lval_err("%s:%i:%i: %s, got '%c'", name, line, col, msg, *p);
   }
+  return lval_err("%s:%i:%i: %s, got end of input", name, line, col, msg);
 }
 
-/* Print an lval value followed by a newline */
-void lval_println(lval* v) {
-  lval_print(v);
-  putchar('\n');
+lval* lval_read_str(char* name, char* src) {
+  return lval_read_buf(name, src, strlen(src), 0);
 }
 
-/**
- * Evaluator / Manipulator
- * 
- */
-
-lval* lval_eval_sexpr(lenv* e, lval* v) {
-  /* Transform of e*v -> v' */
+lval* lval_read_buf(char* name, char* src, long n, int lines) {
+  /* Read all expressions in the 'n' bytes at 'src' into an S-Expression, */
+  /* straight from the buffer without building a parse tree first */
+  /* 'src' need not be terminated, so it may be a mapped file */
+  /* With 'lines', every line is read into an S-Expression of its own as if */
+  /* typed at the prompt, and lists still open continue onto the next line */
+  /* Comments run from ';' to the end of the line */
+  char* end = src + n;
+
+  /* Lists still open, the bottom one collecting the top-level expressions */
+  int base = lines ? 1 : 0;
+  int depth = base;
+  int capacity = 16;
+  lval** open = malloc(sizeof(lval*) * capacity);
+  open[0] = lval_sexpr();
+  if (lines) { open[1] = lval_sexpr(); }
+
+  char* p = src;
+  char* msg = NULL;
+  while (p < end) {
+    char c = *p;
+
+    /* A line ends its expression unless inside a list */
+    if (c == '\n' && lines && depth == base) {
+      if (open[depth]->count) {
+        open[0] = lval_add(open[0], open[depth]);
+        open[depth] = lval_sexpr();
+      }
+      p++;
+      continue;
+    }
 
-  /* Evaluate children */
-  for (int i = 0; i < v->count; i++) {
-    /* Element-wise transformation */
-    v->cell[i] = lval_eval(e, v->cell[i]);
-  }
+    /* Skip whitespace and comments */
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') { p++; continue; }
+    if (c == ';') {
+      while (p < end && *p != '\n') { p++; }
+      continue;
+    }
+
+    /* Open a new list */
+    if (c == '(' || c == '{') {
+      if (depth + 1 == capacity) {
+        capacity *= 2;
+        open = realloc(open, sizeof(lval*) * capacity);
+      }
+      open[++depth] = c == '(' ? lval_sexpr() : lval_qexpr();
+      p++;
+      continue;
+    }
+
+    /* Close the innermost list, adding it to its parent */
+    if (c == ')' || c == '}') {
+      int expect = depth == base ? 0 : LTYPE(open[depth]) == LVAL_SEXPR ? ')' : '}';
+      /* A mismatch inside a list is reported as its missing end below */
+      if (c != expect) { msg = expect ? NULL : "unexpected character"; break; }
+      lval* x = open[depth--];
+      open[depth] = lval_add(open[depth], x);
+      p++;
+      continue;
+    }
+
+    /* Number: /-?[0-9]+/, accumulated towards its sign to reach LONG_MIN */
+    if (isdigit((unsigned char)c)
+      || (c == '-' && p + 1 < end && isdigit((unsigned char)p[1]))) {
+      int neg = (c == '-');
+      if (neg) { p++; }
+      long x = 0;
+      int valid = 1;
+      for (; p < end && isdigit((unsigned char)*p); p++) {
+        int d = *p - '0';
+        if (neg ? x < (LONG_MIN + d) / 10 : x > (LONG_MAX - d) / 10) { valid = 0; }
+        if (valid) { x = neg ? x * 10 - d : x * 10 + d; }
+      }
+      open[depth] = lval_add(open[depth],
+        valid ? lval_num(x) : lval_err("invalid number"));
+      continue;
+    }
+
+    /* String: escapes are resolved into a copy */
+    if (c == '"') {
+      char* q = p + 1;
+      while (q < end && *q != '"') { q += (*q == '\\' && q + 1 < end) ? 2 : 1; }
+      if (q == end) { p = q; msg = "expected '\"'"; break; }
+
+      char* s = malloc(q - p);
+      int len = 0;
+      for (char* r = p + 1; r < q; r++) {
+        if (*r != '\\') { s[len++] = *r; continue; }
+        switch (*++r) {
+          case 'n':  s[len++] = '\n'; break;
+          case 't':  s[len++] = '\t'; break;
+          case 'r':  s[len++] = '\r'; break;
+          default:   s[len++] = *r;   break;
+        }
+      }
+      s[len] = '\0';
+
+      lval* x = lval_alloc();
+      x->type = LVAL_STR;
+      x->ref = 1;
+      x->str = s;
+      open[depth] = lval_add(open[depth], x);
+      p = q + 1;
+      continue;
+    }
+
+    /* Symbol: interned straight from the buffer */
+    char* q = p;
+    while (q < end && lread_symbol_char(*q)) { q++; }
+    if (q == p) { msg = "unexpected character"; break; }
+    lval* x = lval_alloc();
+    x->type = LVAL_SYM;
+    x->ref = 1;
+    x->sym = lsym_intern_n(p, q - p);
+    open[depth] = lval_add(open[depth], x);
+    p = q;
+  }
+
+  /* Stopped early or with lists left open */
+  if (msg || p < end || depth > base) {
+    if (!msg) {
+      msg = LTYPE(open[depth]) == LVAL_SEXPR ? "expected ')'" : "expected '}'";
+    }
+    lval* err = lval_read_err(name, src, end, p, msg);
+    for (int i = 0; i <= depth; i++) { lval_del(open[i]); }
+    free(open);
+    return err;
+  }
+
+  /* The last line need not end in a newline */
+  if (lines) {
+    if (open[1]->count) {
+      open[0] = lval_add(open[0], open[1]);
+    } else {
+      lval_del(open[1]);
+    }
+  }
+
+  lval* x = open[0];
+  free(open);
+  return x;
+}
+
+char* lfile_map(char* path, long* n) {
+  /* Contents of the file at 'path', mapped read-only rather than copied */
+  /* NULL with errno set on failure */
+#ifdef _WIN32
+  FILE* f = fopen(path, "rb");
+  if (!f) { return NULL; }
+  fseek(f, 0, SEEK_END);
+  *n = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char* src = malloc(*n + 1);
+  *n = fread(src, 1, *n, f);
+  fclose(f);
+  return src;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { return NULL; }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  /* Empty files cannot be mapped */
+  *n = st.st_size;
+  if (*n == 0) {
+    close(fd);
+    return "";
+  }
+
+  char* src = mmap(NULL, *n, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  return src == MAP_FAILED ? NULL : src;
+#endif
+}
+
+lval* lfile_write(char* path, char* data, long n) {
+  /* Replace the file at 'path' with the 'n' bytes at 'data' */
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    return lval_err("Could not write file '%s': %s", path, strerror(errno));
+  }
+  fwrite(data, 1, n, f);
+  if (ferror(f) | fclose(f)) {
+    return lval_err("Could not write file '%s': %s", path, strerror(errno));
+  }
+  return lval_sexpr();
+}
+
+void lfile_unmap(char* src, long n) {
+#ifdef _WIN32
+  free(src);
+#else
+  if (n) { munmap(src, n); }
+#endif
+}
+
+lval* lval_read_file(char* path) {
+  /* Read every line of the file at 'path' */
+  long n;
+  char* src = lfile_map(path, &n);
+  if (!src) {
+    return lval_err("Could not load file '%s': %s", path, strerror(errno));
+  }
+
+  /* Nothing read keeps pointing into the mapping */
+  lval* x = lval_read_buf(path, src, n, 1);
+  lfile_unmap(src, n);
+  return x;
+}
+
+/**
+ * Printers
+ * 
+ */
+
+/* Stream of this thread's printers, if not stdout, see LVAL_OUT */
+static __thread lout_stream* lval_out = NULL;
+
+/* Print an s-expression */
+/* Done recursively when lval_print calls lval_expr_print again */
+void lval_expr_print(lval* v, char open, char close) {
+  putc(open, LVAL_OUT);
+  for (int i = 0; i < v->count; i++) {
+    /* Print each lval contained within */
+    lval_print(v->cell[i]);
+
+    /* Print seperating space only for non-last lvals */
+    if (i != (v->count - 1)) {
+      putc(' ', LVAL_OUT);
+    }
+  }
+  putc(close, LVAL_OUT);
+}
+
+/* Print a string quoted, escaping as the reader reads it */
+void lval_str_print(lval* v) {
+  putc('"', LVAL_OUT);
+  for (char* c = v->str; *c; c++) {
+    switch (*c) {
+      case '\n':  fputs("\\n", LVAL_OUT);      break;
+      case '\t':  fputs("\\t", LVAL_OUT);      break;
+      case '\r':  fputs("\\r", LVAL_OUT);      break;
+      case '"':   fputs("\\\"", LVAL_OUT);     break;
+      case '\\':  fputs("\\\\", LVAL_OUT);     break;
+      default:    putc(*c, LVAL_OUT);          break;
+    }
+  }
+  putc('"', LVAL_OUT);
+}
+
+/* Print an lval value */
+void lval_print(lval* v) {
+  switch (LTYPE(v)) {
+    case LVAL_NUM:    fprintf(LVAL_OUT, "%li", LNUM(v));       break;
+    case LVAL_ERR:    fprintf(LVAL_OUT, "Error: %s", v->err);  break;
+    case LVAL_SYM:    fprintf(LVAL_OUT, "%s", v->sym);         break;
+    case LVAL_STR:    lval_str_print(v);                       break;
+    case LVAL_SEXPR:  lval_expr_print(v, '(', ')');            break;
+    case LVAL_QEXPR:  lval_expr_print(v, '{', '}');            break;
+    case LVAL_FUN:
+      if (v->builtin) {
+        fprintf(LVAL_OUT, "<builtin>");
+      } else {
+        putc('(', LVAL_OUT);
+        fprintf(LVAL_OUT, "\\ "); lval_print(v->formals);
+        putc(' ', LVAL_OUT); lval_print(v->body);
+        putc(')', LVAL_OUT);
+      }
+      break;
+    case LVAL_FUT:    fprintf(LVAL_OUT, "<future>");           break;
+    case LVAL_TERM:   fprintf(LVAL_OUT, "<termination>");      break;
+  }
+}
+
+/* Print an lval value followed by a newline */
+void lval_println(lval* v) {
+  /* Whole lines, as tasks may share the stream */
+#ifndef _WIN32
+  flockfile(LVAL_OUT);
+#endif
+  lval_print(v);
+  putc('\n', LVAL_OUT);
+#ifndef _WIN32
+  funlockfile(LVAL_OUT);
+#endif
+}
+
+#ifndef _WIN32
+void lout_open(lout_stream* o) {
+  /* Print into memory in this thread until lout_close */
+  o->data = NULL;
+  o->count = 0;
+  o->tasks = 0;
+  o->f = open_memstream(&o->data, &o->count);
+  lval_out = o;
+}
+
+void lout_close(lout_stream* o) {
+  /* Wait for tasks queued meanwhile, which print here too, then finish */
+  /* 'data' with everything printed, in the order it was */
+  lpar_help(&o->tasks);
+  lval_out = NULL;
+  fclose(o->f);
+}
+#endif
+
+/**
+ * Evaluator / Manipulator
+ * 
+ */
+
+/* Nesting of tree-walking evaluation, counted against the depth limit */
+static __thread int lval_depth = 0;
+
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+  /* Transform of e*v -> v' */
+  if (lvm_full()) {
+    lval_del(v);
+    return lvm_depth_err();
+  }
+  v = lval_own(v);
+  lval_uncompile(v);
+  LGC_SAFEPOINT();
+
+  /* Name the call by its head, for the profiler */
+  char* name = v->count && LTYPE(v->cell[0]) == LVAL_SYM ? v->cell[0]->sym : NULL;
+
+  /* Evaluate children */
+  lval_depth++;
+  for (int i = 0; i < v->count; i++) {
+    /* Element-wise transformation, handing the child over in full */
+    lval* x = v->cell[i];
+    v->cell[i] = NULL;
+    v->cell[i] = lval_eval(e, x);
+  }
+  lval_depth--;
+
+  return lval_apply(e, v, name);
+}
+
+lval* lval_apply(lenv* e, lval* v, char* name) {
+  /* Apply S-Expression 'v' whose children are already evaluated */
+  /* 'name' is the symbol it was headed by, if any */
 
   /* Error checking */
   for (int i = 0; i < v->count; i++) {
-    if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    if (LTYPE(v->cell[i]) == LVAL_ERR) { return lval_take(v, i); }
   }
 
   /* Empty Expression */
@@ -426,32 +1547,38 @@ lval* lval_eval_sexpr(lenv* e, lval* v) {
   /* Single Expression */
   if (v->count == 1 
       /* 0-ary function support? */
-      && v->cell[0]->type != LVAL_FUN
+      && LTYPE(v->cell[0]) != LVAL_FUN
       )
         { return lval_take(v, 0); }
 
   /* Guard that first element is a Function */
   lval* f = lval_pop(v, 0);
-  if (f->type != LVAL_FUN) {
+  if (LTYPE(f) != LVAL_FUN) {
     lval* err = lval_err(
       "S-expression does not start with Function. "
       "Got %s, Expected %s.",
-      ltype_name(f->type), ltype_name(LVAL_FUN));
+      ltype_name(LTYPE(f)), ltype_name(LVAL_FUN));
     lval_del(f);  lval_del(v);
     return err;
   }
   /* Postcondition that v is simple (op num num ...) */
 
   /* If so call function to get result */
-  lval* result = lval_call(e, f, v);
+  lval* result = lval_call(e, f, v, name);
   lval_del(f);
   return result;
 }
 
 lval* lval_eval(lenv* e, lval* v) {
+  /* Run compiled S-Expressions on the virtual machine */
+  if (LTYPE(v) == LVAL_SEXPR && v->code) {
+    lval* x = lvm_exec(e, v->code, NULL);
+    lval_del(v);
+    return x;
+  }
   /* Evaluate S-Expressions by recursively calling */
-  if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-  if (v->type == LVAL_SYM) {
+  if (LTYPE(v) == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
+  if (LTYPE(v) == LVAL_SYM) {
     /* Symbols become an expression to be evaluated by the environment */
     lval* x = lenv_get(e, v);
     lval_del(v);
@@ -461,35 +1588,76 @@ lval* lval_eval(lenv* e, lval* v) {
   return v;
 }
 
+lval* lval_eval_qexpr(lenv* e, lval* x) {
+  /* Evaluate Q-Expression 'x' as code, running its compiled form if any */
+  if (x->code) {
+    lval* r = lvm_exec(e, x->code, NULL);
+    lval_del(x);
+    return r;
+  }
+  /* Convert to list */
+  x = lval_own(x);
+  x->type = LVAL_SEXPR;
+  return lval_eval(e, x);
+}
+
+int lval_eval_batch(lenv* e, lval* exprs) {
+  /* Evaluate each of 'exprs' in order as if typed at the prompt, printing */
+  /* every value, and return whether one was 'exit', which stops there */
+  int term = 0;
+  while (exprs->count && !term) {
+    lval* x = lval_eval(e, lval_pop(exprs, 0));
+    lval_println(x);
+    term = LTYPE(x) == LVAL_TERM;
+    lval_del(x);
+  }
+  lval_del(exprs);
+  return term;
+}
+
 lval* lval_pop(lval* v, int i) {
   /* Effect: Preserve 'v' and 'v->cell[i]' without deallocation  */
+  /* Requires: 'v' is unshared, see lval_own */
+  lval_uncompile(v);
   /* Get element at i'th index */
   lval* x = v->cell[i];
 
-  /* Shift memory layout to left to overwrite i'th element */
-  /* At a, use memory starting at b, for c long */
-  memmove(&v->cell[i], &v->cell[i+1],
-    sizeof(lval*) * (v->count-i-1));  
+  if (i == 0) {
+    /* Popping the head only advances the start of cell */
+    v->cell++;
+    v->offset++;
+  } else {
+    /* Shift memory layout to left to overwrite i'th element */
+    /* At a, use memory starting at b, for c long */
+    memmove(&v->cell[i], &v->cell[i+1],
+      sizeof(lval*) * (v->count-i-1));
+  }
 
   /* Decrement count record */
   v->count--;
 
-  /* Reallocate memory for cell */
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+  /* Empty lists start over from the beginning of their memory */
+  if (v->count == 0) {
+    v->cell -= v->offset;
+    v->offset = 0;
+  }
   return x;
 }
 
 lval* lval_take(lval* v, int i) {
-  lval* x = lval_pop(v, i);
+  /* Keep only the i'th element, 'v' itself may be shared */
+  lval* x = lval_retain(v->cell[i]);
   lval_del(v);
   return x;
 }
 
 lval* lval_join(lval* x, lval* y) {
   /* Join between two lists of cells */
-  /* For each cell in 'y', add it to 'x' */
-  while (y->count) {
-    x = lval_add(x, lval_pop(y, 0));
+  /* For each cell in 'y', add a reference to it to 'x' */
+  x = lval_own(x);
+  lval_reserve(x, y->count);
+  for (int i = 0; i < y->count; i++) {
+    x = lval_add(x, lval_retain(y->cell[i]));
   }
 
   /* Delete 'y' upon consumption and return 'x' */
@@ -497,12 +1665,38 @@ lval* lval_join(lval* x, lval* y) {
   return x;
 }
 
+lval* lval_retain(lval* v) {
+  /* Share 'v' in O(1), released by lval_del */
+  if (LFIX_P(v)) { return v; }
+  LPAR_ADD(v->ref, 1);
+  return v;
+}
+
+lval* lval_own(lval* v) {
+  /* Copy-on-write: consume a reference to 'v' and return an unshared node */
+  if (LFIX_P(v) || __atomic_load_n(&v->ref, __ATOMIC_ACQUIRE) == 1) { return v; }
+  lval* x = lval_copy(v);
+  lval_del(v);
+  return x;
+}
+
 lval* lval_copy(lval* v) {
+  /* Shallow copy: a fresh unshared node whose children are shared */
+  /* Immediate numbers are values already, and futures are shared with */
+  /* the task resolving them */
+  if (LFIX_P(v)) { return v; }
+  if (v->type == LVAL_FUT) { return lval_retain(v); }
+
   /* Allocate new memory */
-  lval* x = malloc(sizeof(lval));
+  lval* x = lval_alloc();
+  LMEM_COUNT(LMEM_COPY, sizeof(lval)
+    + (v->type == LVAL_ERR ? strlen(v->err) + 1 : 0)
+    + (v->type == LVAL_STR ? strlen(v->str) + 1 : 0)
+    + (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR ? sizeof(lval*) * v->count : 0));
 
   /* Copy attributes */
   x->type = v->type;
+  x->ref = 1;
 
   switch (v->type) {
 
@@ -513,31 +1707,46 @@ lval* lval_copy(lval* v) {
         x->builtin = v->builtin;
       } else {
         x->builtin = NULL;
-        x->env = lenv_copy(v->env);
-        x->formals = lval_copy(v->formals);
-        x->body = lval_copy(v->body);
+        /* Rather than copying bound arguments, capture those of 'v' */
+        /* as a shared frame under a fresh one, skipping 'v' if it has none */
+        lval* cap = v->env->count ? v : v->cap;
+        x->env = lenv_new();
+        x->env->up = cap ? cap->env : NULL;
+        x->cap = cap ? lval_retain(cap) : NULL;
+        x->formals = lval_retain(v->formals);
+        x->body = lval_retain(v->body);
       }
       break;
 
-    /* Copy Errors and Symbols (Strings) by allocating the right amount of memory */
-    /* for err and sym */
+    /* Copy Errors (Strings) by allocating the right amount of memory for err */
+    /* Symbols share their interned name */
     case LVAL_ERR:
       x->err = malloc(strlen(v->err) + 1);
       strcpy(x->err, v->err);
       break;
+    case LVAL_STR:
+      x->str = malloc(strlen(v->str) + 1);
+      strcpy(x->str, v->str);
+      break;
     case LVAL_SYM:
-      x->sym = malloc(strlen(v->sym) + 1);
-      strcpy(x->sym, v->sym);
+      x->sym = v->sym;
       break;
 
-    /* Copy Sexpr and Qexpr (Lists) by copying each sub-expression recursively */
+    /* Copy Sexpr and Qexpr (Lists) by sharing each sub-expression */
     case LVAL_SEXPR:
     case LVAL_QEXPR:
+      x->count = 0;
+      x->capacity = 0;
+      x->offset = 0;
+      x->cell = NULL;
+      lval_reserve(x, v->count);
       x->count = v->count;
-      x->cell = malloc(sizeof(lval*) * x->count);
       for (int i = 0; i < x->count; i++) {
-        x->cell[i] = lval_copy(v->cell[i]);
+        x->cell[i] = lval_retain(v->cell[i]);
       }
+      /* Share compiled code rather than recompiling */
+      x->code = v->code;
+      if (x->code) { LPAR_ADD(x->code->ref, 1); }
       break;
   }
 
@@ -546,13 +1755,15 @@ lval* lval_copy(lval* v) {
 
 int lval_eq(lval* x, lval* y) {
   /* Type equality */
-  if (x->type != y->type) { return 0; }
+  if (LTYPE(x) != LTYPE(y)) { return 0; }
 
   /* Match type */
-  switch (x->type) {
-    case LVAL_NUM: return (x->num == y->num);
+  switch (LTYPE(x)) {
+    case LVAL_NUM: return (LNUM(x) == LNUM(y));
     case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-    case LVAL_SYM: return (strcmp(x->err, y->err) == 0);
+    case LVAL_STR: return (strcmp(x->str, y->str) == 0);
+    case LVAL_SYM: return (x->sym == y->sym);
+    case LVAL_FUT: return (x == y);
 
     case LVAL_FUN:
       if (x->builtin || y->builtin) {
@@ -577,97 +1788,1914 @@ int lval_eq(lval* x, lval* y) {
   return 0;
 }
 
-lval* lval_call(lenv* e, lval* f, lval* a) {
+lval* lval_call(lenv* e, lval* f, lval* a, char* name) {
 
   /* Case builtin functions: direct application */
   if (f->builtin) { return f->builtin(e, a); }
   /* Making builtin functions not possible to be partially applied */
 
+  f = lval_bind(e, f, a);
+
+  /* Errors and partially applied functions are results already */
+  if (LTYPE(f) == LVAL_ERR || f->formals->count > 0) { return f; }
+
+  /* If formals are all bound, do evaluate */
+  /* Set the parent env, the largest scope for evaluation, as 'e', so as to define most variables */
+  f->env->par = e;
+  lval* result = f->body->code
+    ? lvm_exec(f->env, f->body->code, name ? name : "lambda")
+    /* Fallback to tree-walking evaluation of the body */
+    : lval_eval_qexpr(f->env, lval_retain(f->body));
+  lval_del(f);
+  return result;
+}
+
+lval* lval_bind(lenv* e, lval* f, lval* a) {
+  /* Bind arguments 'a' to formals of user-defined 'f', consuming 'a' */
+  /* Returns the bound copy of 'f', partially applied if formals remain, or an error */
+
+  /* Interned variable argument operator, compared by pointer */
+  static char* amp = NULL;
+  if (!amp) { amp = lsym_intern("&"); }
+
+  /* Bind into a private copy, as 'f' may be shared with an environment */
+  /* The copy shares body and bound values, only env and formals are fresh, */
+  /* so partial application costs only the arguments given at each step */
+  f = lval_copy(f);
+  f->formals = lval_own(f->formals);
+
   /* Count arguments and match */
   int given = a->count;
   int total = f->formals->count;
 
-  /* While there remains arguments being supplied */
-  /* If under-supplied, this resembles Partial Application */
-  while (a->count) {
-    /* If no more formals to be applied to */
-    if (f->formals->count == 0) {
-      lval_del(a);
-      return lval_err("Function passed too many arguments. "
-                      "Got %i, Expected %i.", given, total);
+  /* While there remains arguments being supplied */
+  /* If under-supplied, this resembles Partial Application */
+  while (a->count) {
+    /* If no more formals to be applied to */
+    if (f->formals->count == 0) {
+      lval_del(a);  lval_del(f);
+      return lval_err("Function passed too many arguments. "
+                      "Got %i, Expected %i.", given, total);
+    }
+
+    /* Incrementally grab formal and argument pair */
+    lval* sym = lval_pop(f->formals, 0);
+
+    /* Variably-long Arguments: 'x & xs' */
+    /* If 'sym' is variable argument operator '&' */
+    if (sym->sym == amp) {
+      /* Ensure '&' is followed by one more symbol in 'formals' */
+      if (f->formals->count != 1) {
+        lval_del(a);  lval_del(f);  lval_del(sym);
+        return lval_err("Function format invalid. "
+          "Symbol '&' not followed by single symbol.");
+      }
+
+      /* Bind that list of formals to the tail of arguments */
+      lval* nsym = lval_pop(f->formals, 0);
+      lenv_put(f->env, nsym, builtin_list(e, a));
+      lval_del(sym);  lval_del(nsym);
+
+      /* First pass in loop, can immediately break */
+      break;
+    }
+
+    /* Incrementally grab formal and argument pair */
+    lval* val = lval_pop(a, 0);
+
+    /* Bind the pair in 'f''s env, then get deleted */
+    lenv_put(f->env, sym, val);
+    lval_del(sym);  lval_del(val);
+  }
+  /* Argument list is completely bound */
+  lval_del(a);
+
+  /* Variably-long Formals are not satuated with variably-long Arguments */
+  /* Handles this case only: (\ {x & w} {...}) x' -> {...}[x = x', w = {}] */
+  /* (\ {x y & w} {...}) x' -> \ {y & w} {...[x = x']} */
+  /* (\ {x y z} {...} x') -> \ {y z} {...[x = x']} */
+  if (f->formals->count > 0 &&
+    f->formals->cell[0]->sym == amp) {
+    
+    /* Guard that '& xs' is not followed */
+    if (f->formals->count != 2) {
+      lval_del(f);
+      return lval_err("Function format invalid. "
+        "Symbol '&' not followed by single symbol");
+    }
+    /* Post condition:  */
+
+    /* Pop and delete redundant '&' */
+    lval_del(lval_pop(f->formals, 0));
+
+    /* Pop next symbol and create an empty list */
+    lval* sym = lval_pop(f->formals, 0);
+    lval* val = lval_qexpr();
+
+    /* Bind this pair in env and delete */
+    lenv_put(f->env, sym, val);
+    lval_del(sym);  lval_del(val);
+  }
+
+  return f;
+}
+
+
+/**
+ * Compiler / Virtual Machine
+ * 
+ * Lambda bodies are lowered once into postfix bytecode, so calling a
+ * function no longer copies and re-walks its body Q-Expression
+ */
+
+/* Lists being compiled or folded, each inside the last, so that code too */
+/* deeply nested to compile on the C stack is left uncompiled instead */
+static __thread int lcompile_depth = 0;
+static __thread int lcompile_failed = 0;
+
+lchunk* lchunk_new(void) {
+  lchunk* c = malloc(sizeof(lchunk));
+  c->ref = 1;
+  c->count = 0;
+  c->ops = NULL;
+  c->nconsts = 0;
+  c->consts = NULL;
+  c->names = NULL;
+  c->formals = NULL;
+  c->folds = 0;
+  return c;
+}
+
+void lchunk_del(lchunk* c) {
+  /* Only free when the last holder lets go */
+  if (LPAR_ADD(c->ref, -1) > 0) { return; }
+  for (int i = 0; i < c->nconsts; i++) {
+    lval_del(c->consts[i]);
+  }
+  free(c->consts);
+  free(c->ops);
+  free(c->names);
+  if (c->formals) { lval_del(c->formals); }
+  free(c);
+}
+
+void lchunk_emit(lchunk* c, int op, int arg) {
+  c->count += 2;
+  c->ops = realloc(c->ops, sizeof(int) * c->count);
+  c->ops[c->count - 2] = op;
+  c->ops[c->count - 1] = arg;
+  c->names = realloc(c->names, sizeof(char*) * (c->count / 2));
+  c->names[c->count / 2 - 1] = NULL;
+  LMEM_COUNT(LMEM_CODE, sizeof(int) * 2 + sizeof(char*));
+}
+
+void lchunk_emit_call(lchunk* c, lval* v) {
+  /* Apply S-Expression 'v', named by its head if that is a symbol */
+  lchunk_emit(c, OP_CALL, v->count);
+  if (v->count && LTYPE(v->cell[0]) == LVAL_SYM) {
+    c->names[c->count / 2 - 1] = v->cell[0]->sym;
+  }
+}
+
+int lchunk_const(lchunk* c, lval* v) {
+  /* Take ownership of 'v' and return its index in the constant pool */
+  c->nconsts++;
+  c->consts = realloc(c->consts, sizeof(lval*) * c->nconsts);
+  c->consts[c->nconsts - 1] = v;
+  return c->nconsts - 1;
+}
+
+/* Constant Folding */
+/* Calls of pure builtins on constants in function bodies are run once */
+/* when compiled. Scope is dynamic, so a name rebound anywhere may be seen */
+/* by any body: folded values are only used until a builtin they call is */
+/* rebound by a definition, or shadowed by the formals of a lambda */
+
+static lbuiltin lfold_funcs[] = {
+  builtin_add, builtin_sub, builtin_mul, builtin_div, builtin_mod, builtin_exp,
+  builtin_max, builtin_min, builtin_eq, builtin_ne, builtin_gt, builtin_lt,
+  builtin_ge, builtin_le, builtin_list, builtin_len
+};
+#define LFOLD_COUNT ((int)(sizeof(lfold_funcs) / sizeof(lbuiltin)))  /* At most 32 */
+static char* lfold_syms[LFOLD_COUNT];   /* Interned name of each, once registered */
+static unsigned lfold_rebound = 0;     /* Bit of each name bound to anything else */
+
+void lfold_register(char* sym, lbuiltin func) {
+  for (int i = 0; i < LFOLD_COUNT; i++) {
+    if (lfold_funcs[i] == func) { lfold_syms[i] = sym; }
+  }
+}
+
+int lfold_index(char* sym) {
+  /* Position of the pure builtin named by interned 'sym', else -1 */
+  for (int i = 0; i < LFOLD_COUNT; i++) {
+    if (lfold_syms[i] == sym) { return i; }
+  }
+  return -1;
+}
+
+void lfold_bind(char* sym, lval* v) {
+  /* Note 'sym' being bound to 'v' (NULL for a formal), which invalidates */
+  /* calls folded through it unless 'v' is that same builtin */
+  int i = lfold_index(sym);
+  if (i < 0 || (v && LTYPE(v) == LVAL_FUN && v->builtin == lfold_funcs[i])) { return; }
+  __atomic_or_fetch(&lfold_rebound, 1u << i, __ATOMIC_RELEASE);
+}
+
+lval* lval_fold(lval* v, unsigned* folds) {
+  /* Value of S-Expression 'v' if it only calls pure builtins on constants, */
+  /* else NULL, also when that is an error so it is raised as usual */
+  /* Adds the bit of each builtin called to 'folds' */
+  if (v->count == 0 || LTYPE(v->cell[0]) != LVAL_SYM) { return NULL; }
+  if (lcompile_depth == LVM_MAX_NESTING) { return NULL; }
+  int i = lfold_index(v->cell[0]->sym);
+  if (i < 0 || (__atomic_load_n(&lfold_rebound, __ATOMIC_ACQUIRE) & (1u << i))) {
+    return NULL;
+  }
+  lbuiltin f = lfold_funcs[i];
+  *folds |= 1u << i;
+
+  lval* a = lval_sexpr();
+  lcompile_depth++;
+  for (int i = 1; i < v->count && a; i++) {
+    lval* x = v->cell[i];
+    switch (LTYPE(x)) {
+      case LVAL_NUM:
+      case LVAL_STR:
+      case LVAL_QEXPR: x = lval_retain(x); break;
+      case LVAL_SEXPR: x = lval_fold(x, folds); break;
+      default:         x = NULL;           break;
+    }
+    if (!x) { lval_del(a); a = NULL; break; }
+    lval_add(a, x);
+  }
+  lcompile_depth--;
+  if (!a) { return NULL; }
+
+  lval* r = f(NULL, a);
+  if (LTYPE(r) == LVAL_ERR) { lval_del(r); return NULL; }
+  return r;
+}
+
+int lchunk_emit_fold(lchunk* c, lval* v) {
+  /* Emit the folded value of 'v' (if any) ahead of the code evaluating it, */
+  /* returning the OP_JUMP operand to patch once that code is emitted, or -1 */
+  unsigned folds = 0;
+  lval* x = lval_fold(v, &folds);
+  if (!x) { return -1; }
+  c->folds |= folds;
+  lchunk_emit(c, OP_FOLD, lchunk_const(c, x));
+  lchunk_emit(c, OP_JUMP, 0);
+  return c->count - 1;
+}
+
+void lchunk_patch_fold(lchunk* c, int jump) {
+  /* Make the OP_JUMP at 'jump' skip the code emitted since */
+  if (jump >= 0) { c->ops[jump] = (c->count - jump - 1) / 2; }
+}
+
+int lval_formal_slot(lval* formals, char* sym) {
+  /* Position 'sym' is bound at in the env of a call, given 'formals' */
+  /* Formals are bound in order, skipping '&', so they come first */
+  int slot = 0;
+  for (int i = 0; formals && i < formals->count; i++) {
+    if (formals->cell[i]->sym == sym) { return slot; }
+    if (strcmp(formals->cell[i]->sym, "&") != 0) { slot++; }
+  }
+  return -1;
+}
+
+void lval_compile_node(lchunk* c, lval* v, lval* formals) {
+  /* Too deep to compile, failing the outermost lval_compile_in */
+  if (lcompile_depth == LVM_MAX_NESTING) {
+    lcompile_failed = 1;
+    return;
+  }
+  lcompile_depth++;
+  switch (LTYPE(v)) {
+    /* Symbols are resolved in the calling environment at run time */
+    /* Formals are tried at their slot first, see OP_ARG */
+    case LVAL_SYM: {
+      int slot = lval_formal_slot(formals, v->sym);
+      if (slot >= 0) { lchunk_emit(c, OP_ARG, slot); }
+      lchunk_emit(c, OP_LOAD, lchunk_const(c, lval_retain(v)));
+      break;
+    }
+
+    /* Evaluate every child in order, then apply */
+    /* Function bodies try a folded value first */
+    case LVAL_SEXPR: {
+      int jump = formals ? lchunk_emit_fold(c, v) : -1;
+      for (int i = 0; i < v->count; i++) {
+        lval_compile_node(c, v->cell[i], formals);
+      }
+      lchunk_emit_call(c, v);
+      lchunk_patch_fold(c, jump);
+      break;
+    }
+
+    /* Q-Expressions are data, but may later run via 'if' or 'eval' */
+    /* so compile them too, most often as branches in the same call */
+    case LVAL_QEXPR:
+      lval_compile_in(v, formals);
+      lchunk_emit(c, OP_CONST, lchunk_const(c, lval_retain(v)));
+      break;
+
+    /* Numbers, Errors and Functions evaluate to themselves */
+    default:
+      lchunk_emit(c, OP_CONST, lchunk_const(c, lval_retain(v)));
+      break;
+  }
+  lcompile_depth--;
+}
+
+lval* lval_compile(lval* v) {
+  return lval_compile_in(v, NULL);
+}
+
+lval* lval_compile_in(lval* v, lval* formals) {
+  /* Attach code evaluating S/Q-Expression 'v' as an S-Expression */
+  /* as the body of a function with 'formals', if any */
+  /* Code for other formals is still correct, just without the slots, */
+  /* so it is kept while other threads may be running it */
+  lchunk* code = __atomic_load_n(&v->code, __ATOMIC_ACQUIRE);
+  if (code && (!formals || code->formals == formals || LPAR_ACTIVE())) { return v; }
+
+  /* Threads compiling the same list wait for the first */
+  /* Lists nested too deeply are left without code, see lval_compile_err */
+  lpar_lock();
+  if (!v->code || !LPAR_ACTIVE()) {
+    lval_uncompile(v);
+
+    lchunk* c = lchunk_new();
+    if (formals) { c->formals = lval_retain(formals); }
+    int jump = formals ? lchunk_emit_fold(c, v) : -1;
+    for (int i = 0; i < v->count && !lcompile_failed; i++) {
+      lval_compile_node(c, v->cell[i], formals);
+    }
+    lchunk_emit_call(c, v);
+    lchunk_patch_fold(c, jump);
+    lchunk_emit(c, OP_RET, 0);
+
+    if (lcompile_failed) {
+      lchunk_del(c);
+      if (lcompile_depth == 0) { lcompile_failed = 0; }
+    } else {
+      __atomic_store_n(&v->code, c, __ATOMIC_RELEASE);
+    }
+  }
+  lpar_unlock();
+  return v;
+}
+
+lval* lval_compile_err(void) {
+  return lval_err("Maximum nesting %i of code exceeded.", LVM_MAX_NESTING);
+}
+
+void lval_uncompile(lval* v) {
+  /* Compiled code no longer matches a mutated list */
+  if (v->code) {
+    lchunk_del(v->code);
+    v->code = NULL;
+  }
+}
+
+/* Value stack of the virtual machine, shared by nested invocations */
+/* Each thread runs its own stacks */
+static __thread int lvm_count = 0;
+static __thread int lvm_capacity = 0;
+static __thread lval** lvm_stack = NULL;
+
+/* Call frames of the virtual machine, so Lisp calls do not nest C calls */
+/* Deeper evaluation than 'lvm_max_depth' fails with an error instead */
+static int lvm_max_depth = LVM_MAX_DEPTH;
+static __thread int lvm_depth = 0;
+static __thread int lvm_frames_capacity = 0;
+static __thread lframe* lvm_frames = NULL;
+
+/* Set by the profiler's timer, see LPROF_SAFEPOINT */
+static volatile sig_atomic_t lprof_pending = 0;
+
+void lvm_push(lval* v) {
+  if (lvm_count == lvm_capacity) {
+    lvm_capacity = lvm_capacity ? lvm_capacity * 2 : 64;
+    lvm_stack = realloc(lvm_stack, sizeof(lval*) * lvm_capacity);
+  }
+  lvm_stack[lvm_count++] = v;
+}
+
+int lvm_full(void) {
+  /* Whether evaluation is as deep as allowed */
+  return lvm_depth + lval_depth >= lvm_max_depth;
+}
+
+lval* lvm_depth_err(void) {
+  return lval_err("Maximum evaluation depth %i exceeded.", lvm_max_depth);
+}
+
+void lvm_enter(lchunk* c, lenv* e, lval* f, char* name) {
+  /* Push a frame running 'c' in 'e', holding 'c' and owning 'f' if any */
+  /* 'name' is the function called, NULL when not running a function */
+  if (lvm_depth == lvm_frames_capacity) {
+    lvm_frames_capacity = lvm_frames_capacity ? lvm_frames_capacity * 2 : 64;
+    lvm_frames = realloc(lvm_frames, sizeof(lframe) * lvm_frames_capacity);
+  }
+  LPAR_ADD(c->ref, 1);
+  lframe* fr = &lvm_frames[lvm_depth++];
+  fr->code = c;
+  fr->pc = 0;
+  fr->env = e;
+  fr->fun = f;
+  fr->name = name;
+}
+
+void lvm_leave(void) {
+  lframe* fr = &lvm_frames[--lvm_depth];
+  lchunk_del(fr->code);
+  if (fr->fun) { lval_del(fr->fun); }
+}
+
+lchunk* lvm_code(lval* x) {
+  /* Code of Q-Expression 'x', compiling it on first use */
+  return lval_compile(x)->code;
+}
+
+int lvm_inline(lval* v) {
+  /* Whether applying 'v' is a call the virtual machine runs itself */
+  /* rather than nesting: user-defined functions, 'if' and 'eval' */
+  if (v->count == 0 || LTYPE(v->cell[0]) != LVAL_FUN) { return 0; }
+  for (int i = 1; i < v->count; i++) {
+    if (LTYPE(v->cell[i]) == LVAL_ERR) { return 0; }
+  }
+
+  lval* f = v->cell[0];
+  if (!f->builtin) { return 1; }
+  /* Malformed 'if' and 'eval' go to the builtin to report the error */
+  if (f->builtin == builtin_if) {
+    return v->count == 4 && LTYPE(v->cell[1]) == LVAL_NUM
+      && LTYPE(v->cell[2]) == LVAL_QEXPR && LTYPE(v->cell[3]) == LVAL_QEXPR;
+  }
+  if (f->builtin == builtin_eval) {
+    return v->count == 2 && LTYPE(v->cell[1]) == LVAL_QEXPR;
+  }
+  return 0;
+}
+
+void lvm_tail_env(lval* g, lframe* fr) {
+  /* Tail call of 'g' from frame 'fr' which is about to be dropped */
+  /* Scope is dynamic, so 'g' must still see the caller's bindings: */
+  /* copy those it does not shadow, then skip the caller's env */
+  lenv* old = fr->fun->env;
+  for (lenv* f = old; f; f = f->up) {
+    for (int i = 0; i < f->count; i++) {
+      if (!lenv_has(g->env, f->syms[i])) {
+        /* Only the name of a key is read */
+        lval k;
+        k.sym = f->syms[i];
+        lenv_put(g->env, &k, f->vals[i]);
+      }
+    }
+  }
+  g->env->par = old->par;
+}
+
+lval* lvm_exec(lenv* e, lchunk* c, char* name) {
+  /* Dispatch loop running 'c' in environment 'e', as function 'name' if any */
+  if (lvm_full()) { return lvm_depth_err(); }
+  int entry = lvm_depth;
+  lvm_enter(c, e, NULL, name);
+
+  for (;;) {
+    /* Frames may move as the frame stack grows, so refetch each step */
+    lframe* fr = &lvm_frames[lvm_depth - 1];
+    int op = fr->code->ops[fr->pc];
+    int arg = fr->code->ops[fr->pc + 1];
+    fr->pc += 2;
+
+    switch (op) {
+      case OP_CONST:
+        lvm_push(lval_retain(fr->code->consts[arg]));
+        break;
+
+      case OP_LOAD:
+        lvm_push(lenv_get(fr->env, fr->code->consts[arg]));
+        break;
+
+      case OP_ARG: {
+        /* Formals are bound first in the env of a call, so the symbol of */
+        /* the OP_LOAD that follows is at slot 'arg' when running its body */
+        lval* k = fr->code->consts[fr->code->ops[fr->pc + 1]];
+        /* The global environment binds nothing itself, see lenv_share */
+        if (arg < fr->env->count && fr->env->syms[arg] == k->sym) {
+          lvm_push(lval_retain(fr->env->vals[arg]));
+          fr->pc += 2;
+        }
+        break;
+      }
+
+      case OP_FOLD:
+        /* Folded while no pure builtin it calls was rebound, see lval_fold */
+        /* Otherwise skip the OP_JUMP past the code it stands for */
+        if (!(__atomic_load_n(&lfold_rebound, __ATOMIC_ACQUIRE) & fr->code->folds)) {
+          lvm_push(lval_retain(fr->code->consts[arg]));
+        } else {
+          fr->pc += 2;
+        }
+        break;
+
+      case OP_JUMP:
+        fr->pc += 2 * arg;
+        break;
+
+      case OP_CALL: {
+        LGC_SAFEPOINT();
+        LPROF_SAFEPOINT();
+        char* name = fr->code->names[fr->pc / 2 - 1];
+        if (!name) { name = "lambda"; }
+        /* Move top 'arg' values into a fresh S-Expression and apply it */
+        lval* v = lval_sexpr();
+        lval_reserve(v, arg);
+        v->count = arg;
+        lvm_count -= arg;
+        if (arg) { memcpy(v->cell, &lvm_stack[lvm_count], sizeof(lval*) * arg); }
+
+        if (!lvm_inline(v)) {
+          lvm_push(lval_apply(fr->env, v, name));
+          break;
+        }
+
+        /* A call right before return is a tail call, reusing this frame */
+        int tail = fr->code->ops[fr->pc] == OP_RET;
+        lval* f = lval_pop(v, 0);
+
+        if (f->builtin) {
+          /* 'if' picks a branch and 'eval' its argument, to run as code */
+          lval* x = lval_retain(f->builtin == builtin_if
+            ? v->cell[LNUM(v->cell[0]) ? 1 : 2]
+            : v->cell[0]);
+          lchunk* code = lvm_code(x);
+          lval_del(f);  lval_del(v);
+
+          if (!code) {
+            lvm_push(lval_compile_err());
+          } else if (tail) {
+            LPAR_ADD(code->ref, 1);
+            lchunk_del(fr->code);
+            fr->code = code;
+            fr->pc = 0;
+          } else if (lvm_full()) {
+            lvm_push(lvm_depth_err());
+          } else {
+            lvm_enter(code, fr->env, NULL, NULL);
+          }
+          lval_del(x);
+          break;
+        }
+
+        lval* g = lval_bind(fr->env, f, v);
+        lval_del(f);
+        if (LTYPE(g) == LVAL_ERR || g->formals->count > 0) {
+          lvm_push(g);
+          break;
+        }
+
+        lchunk* code = lvm_code(g->body);
+        if (!code) {
+          lval_del(g);
+          lvm_push(lval_compile_err());
+        } else if (tail) {
+          /* Replace this frame by the callee */
+          if (fr->fun) {
+            lvm_tail_env(g, fr);
+            lval_del(fr->fun);
+          } else {
+            g->env->par = fr->env;
+          }
+          LPAR_ADD(code->ref, 1);
+          lchunk_del(fr->code);
+          fr->code = code;
+          fr->pc = 0;
+          fr->env = g->env;
+          fr->fun = g;
+          fr->name = name;
+        } else if (lvm_full()) {
+          lval_del(g);
+          lvm_push(lvm_depth_err());
+        } else {
+          /* Set the parent env as the caller's, so as to define most variables */
+          g->env->par = fr->env;
+          lvm_enter(code, g->env, g, name);
+        }
+        break;
+      }
+
+      case OP_RET: {
+        lvm_leave();
+        if (lvm_depth == entry) { return lvm_stack[--lvm_count]; }
+        /* Result stays on the value stack for the caller's frame */
+        break;
+      }
+    }
+  }
+}
+
+
+/**
+ * Profiler
+ * 
+ * A timer asks for the stack of Lisp calls to be sampled at the next call,
+ * where frames are consistent; each sample is counted by its folded stack,
+ * the names of the functions called from outermost to innermost
+ */
+
+static int lprof_interval = 0;    /* Microseconds between samples, 0 when off */
+static long lprof_samples = 0;
+static lprof_table lprof_stacks;  /* Samples of each folded stack */
+
+/* Folded stack being built */
+static int lprof_length = 0;
+static int lprof_capacity = 0;
+static char* lprof_buffer = NULL;
+
+#ifndef _WIN32
+void lprof_signal(int sig) {
+  lprof_pending = 1;
+}
+#endif
+
+int lprof_start(int interval) {
+  /* Sample every 'interval' microseconds of CPU time, 0 if unsupported */
+#ifdef _WIN32
+  return 0;
+#else
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = lprof_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, NULL) < 0) { return 0; }
+
+  struct itimerval it;
+  it.it_interval.tv_sec = interval / 1000000;
+  it.it_interval.tv_usec = interval % 1000000;
+  it.it_value = it.it_interval;
+  if (setitimer(ITIMER_PROF, &it, NULL) < 0) { return 0; }
+
+  lprof_interval = interval;
+  return 1;
+#endif
+}
+
+void lprof_stop(void) {
+#ifndef _WIN32
+  struct itimerval it;
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_PROF, &it, NULL);
+#endif
+  lprof_pending = 0;
+}
+
+void lprof_append(char* s, int n) {
+  if (lprof_length + n > lprof_capacity) {
+    lprof_capacity = lprof_capacity ? lprof_capacity * 2 : 256;
+    if (lprof_capacity < lprof_length + n) { lprof_capacity = lprof_length + n; }
+    lprof_buffer = realloc(lprof_buffer, lprof_capacity);
+  }
+  memcpy(lprof_buffer + lprof_length, s, n);
+  lprof_length += n;
+}
+
+int lprof_find(lprof_table* t, char* s, int n) {
+  /* Position of the 'n' characters at 's' in 't', adding them if new */
+  if ((t->count + 1) * 2 > t->capacity) {
+    free(t->index);
+    t->capacity = t->capacity ? t->capacity * 2 : 64;
+    t->index = calloc(t->capacity, sizeof(int));
+    for (int i = 0; i < t->count; i++) {
+      unsigned long h = lsym_hash(t->keys[i], strlen(t->keys[i])) & (t->capacity - 1);
+      while (t->index[h]) { h = (h + 1) & (t->capacity - 1); }
+      t->index[h] = i + 1;
+    }
+  }
+
+  unsigned long h = lsym_hash(s, n) & (t->capacity - 1);
+  while (t->index[h]) {
+    char* k = t->keys[t->index[h] - 1];
+    if (strncmp(k, s, n) == 0 && k[n] == '\0') { return t->index[h] - 1; }
+    h = (h + 1) & (t->capacity - 1);
+  }
+
+  t->keys = realloc(t->keys, sizeof(char*) * (t->count + 1));
+  t->counts = realloc(t->counts, sizeof(long) * (t->count + 1));
+  t->keys[t->count] = malloc(n + 1);
+  memcpy(t->keys[t->count], s, n);
+  t->keys[t->count][n] = '\0';
+  t->counts[t->count] = 0;
+  t->index[h] = ++t->count;
+  return t->count - 1;
+}
+
+void lprof_free(lprof_table* t) {
+  for (int i = 0; i < t->count; i++) { free(t->keys[i]); }
+  free(t->keys);
+  free(t->counts);
+  free(t->index);
+  memset(t, 0, sizeof(lprof_table));
+}
+
+void lprof_sample(void) {
+  /* Count the current stack of named frames, of the thread running */
+  lpar_lock();
+  lprof_pending = 0;
+  lprof_length = 0;
+  for (int i = 0; i < lvm_depth; i++) {
+    char* name = lvm_frames[i].name;
+    if (!name) { continue; }
+    if (lprof_length) { lprof_append(";", 1); }
+    lprof_append(name, strlen(name));
+  }
+  if (!lprof_length) { lprof_append("(top)", 5); }
+
+  /* Kept apart from interned symbols, so they go once reported */
+  int id = lprof_find(&lprof_stacks, lprof_buffer, lprof_length);
+  lprof_stacks.counts[id]++;
+  lprof_samples++;
+  lpar_unlock();
+}
+
+void lprof_report(FILE* folded, FILE* summary) {
+  /* Folded stacks as 'outer;inner count' lines for flame graph tools, */
+  /* and time of each function by itself (self) and with its callees (total) */
+  /* Samples are dropped once reported */
+  lprof_table* stacks = &lprof_stacks;
+  for (int i = 0; i < stacks->count; i++) {
+    fprintf(folded, "%s %li\n", stacks->keys[i], stacks->counts[i]);
+  }
+
+  /* Functions by order of first appearance, each counted once per stack */
+  /* Self time is counted in 'counts' of 'funcs' */
+  lprof_table funcs = { 0, NULL, NULL, 0, NULL };
+  long* total = NULL;
+  int* last = NULL;
+  for (int i = 0; i < stacks->count; i++) {
+    char* s = stacks->keys[i];
+    while (*s) {
+      int n = strcspn(s, ";");
+      int known = funcs.count;
+      int f = lprof_find(&funcs, s, n);
+      if (f == known) {
+        total = realloc(total, sizeof(long) * funcs.count);
+        last = realloc(last, sizeof(int) * funcs.count);
+        total[f] = 0;  last[f] = -1;
+      }
+      if (last[f] != i) { total[f] += stacks->counts[i]; last[f] = i; }
+      s += n;
+      if (!*s) { funcs.counts[f] += stacks->counts[i]; } else { s++; }
+    }
+  }
+  long* self = funcs.counts;
+  char** names = funcs.keys;
+
+  /* Hottest by self time first */
+  int* order = malloc(sizeof(int) * (funcs.count + 1));
+  for (int i = 0; i < funcs.count; i++) {
+    int j = i;
+    for (; j > 0 && self[order[j - 1]] < self[i]; j--) { order[j] = order[j - 1]; }
+    order[j] = i;
+  }
+
+  double ms = lprof_interval / 1000.0;
+  long samples = lprof_samples ? lprof_samples : 1;
+  fprintf(summary, "%li samples every %ius\n", lprof_samples, lprof_interval);
+  fprintf(summary, "  self%%    self ms   total%%   total ms  function\n");
+  for (int k = 0; k < funcs.count; k++) {
+    int f = order[k];
+    fprintf(summary, "%6.1f%% %10.1f  %6.1f%% %10.1f  %s\n",
+      100.0 * self[f] / samples, self[f] * ms,
+      100.0 * total[f] / samples, total[f] * ms, names[f]);
+  }
+
+  free(order);
+  free(total);  free(last);
+  lprof_free(&funcs);
+  lprof_free(stacks);
+  lprof_samples = 0;
+  free(lprof_buffer);
+  lprof_buffer = NULL;
+  lprof_length = 0;
+  lprof_capacity = 0;
+}
+
+/**
+ * Serialization
+ * 
+ * A versioned binary encoding of lvals, to ship them between processes
+ * and to save images of the global environment
+ * Numbers are varints, lists are prefixed by their length, and each
+ * symbol name is written once then referred to by its order in the stream
+ * Values held more than once, or in a cycle, are likewise written once
+ */
+
+/* Builtins as they were added by name, so encodings can refer to them */
+static int lbuiltin_count = 0;
+static int lbuiltin_capacity = 0;
+static char** lbuiltin_names = NULL;
+static lbuiltin* lbuiltin_funcs = NULL;
+
+void lbuiltin_register(char* name, lbuiltin func) {
+  for (int i = 0; i < lbuiltin_count; i++) {
+    if (lbuiltin_funcs[i] == func) { return; }
+  }
+  if (lbuiltin_count == lbuiltin_capacity) {
+    lbuiltin_capacity = lbuiltin_capacity ? lbuiltin_capacity * 2 : 64;
+    lbuiltin_names = realloc(lbuiltin_names, sizeof(char*) * lbuiltin_capacity);
+    lbuiltin_funcs = realloc(lbuiltin_funcs, sizeof(lbuiltin) * lbuiltin_capacity);
+  }
+  lbuiltin_names[lbuiltin_count] = lsym_intern(name);
+  lbuiltin_funcs[lbuiltin_count] = func;
+  lfold_register(lbuiltin_names[lbuiltin_count], func);
+  lbuiltin_count++;
+}
+
+char* lbuiltin_name(lbuiltin func) {
+  for (int i = 0; i < lbuiltin_count; i++) {
+    if (lbuiltin_funcs[i] == func) { return lbuiltin_names[i]; }
+  }
+  return NULL;
+}
+
+lbuiltin lbuiltin_find(char* name) {
+  /* 'name' is interned */
+  for (int i = 0; i < lbuiltin_count; i++) {
+    if (lbuiltin_names[i] == name) { return lbuiltin_funcs[i]; }
+  }
+  return NULL;
+}
+
+/* Writing */
+
+int lser_table_id(lser_table* t, void* k) {
+  /* Order in which 'k' was first seen, else -1 after recording it */
+  if ((t->count + 1) * 2 > t->capacity) {
+    int capacity = t->capacity ? t->capacity * 2 : 256;
+    void** keys = calloc(capacity, sizeof(void*));
+    int* ids = malloc(sizeof(int) * capacity);
+    for (int i = 0; i < t->capacity; i++) {
+      if (!t->keys[i]) { continue; }
+      unsigned long h = LSYM_HASH(t->keys[i]) & (capacity - 1);
+      while (keys[h]) { h = (h + 1) & (capacity - 1); }
+      keys[h] = t->keys[i];
+      ids[h] = t->ids[i];
+    }
+    free(t->keys);
+    free(t->ids);
+    t->keys = keys;
+    t->ids = ids;
+    t->capacity = capacity;
+  }
+
+  unsigned long h = LSYM_HASH(k) & (t->capacity - 1);
+  while (t->keys[h]) {
+    if (t->keys[h] == k) { return t->ids[h]; }
+    h = (h + 1) & (t->capacity - 1);
+  }
+  t->keys[h] = k;
+  t->ids[h] = t->count++;
+  return -1;
+}
+
+void lser_put_bytes(lser_out* out, char* s, long n) {
+  if (out->count + n > out->capacity) {
+    out->capacity = out->capacity ? out->capacity * 2 : 256;
+    if (out->capacity < out->count + n) { out->capacity = out->count + n; }
+    out->data = realloc(out->data, out->capacity);
+  }
+  memcpy(out->data + out->count, s, n);
+  out->count += n;
+}
+
+void lser_put_uint(lser_out* out, unsigned long x) {
+  /* Seven bits at a time, least significant first, high bit if more follow */
+  char b[10];
+  int n = 0;
+  do {
+    b[n] = x & 0x7f;
+    x >>= 7;
+    if (x) { b[n] |= 0x80; }
+    n++;
+  } while (x);
+  lser_put_bytes(out, b, n);
+}
+
+void lser_put_int(lser_out* out, long x) {
+  /* Zigzag, so small negative numbers stay short */
+  lser_put_uint(out, x < 0 ? (~(unsigned long)x << 1) | 1 : (unsigned long)x << 1);
+}
+
+void lser_put_str(lser_out* out, char* s) {
+  long n = strlen(s);
+  lser_put_uint(out, n);
+  lser_put_bytes(out, s, n);
+}
+
+void lser_put_sym(lser_out* out, char* sym) {
+  /* 'sym' is interned, its name follows only when first written */
+  int id = lser_table_id(&out->syms, sym);
+  lser_put_uint(out, id >= 0 ? id : out->syms.count - 1);
+  if (id < 0) { lser_put_str(out, sym); }
+}
+
+void lser_put_tag(lser_out* out, int tag) {
+  char b = tag;
+  lser_put_bytes(out, &b, 1);
+}
+
+void lser_put_frames(lser_out* out, lenv* e) {
+  /* Bindings of 'e' after those of the frames it captured, which they shadow */
+  /* Outermost first, without recursing along chains of captured frames */
+  int n = 0;
+  for (lenv* f = e; f; f = f->up) { n++; }
+  lenv** frames = malloc(sizeof(lenv*) * n);
+  n = 0;
+  for (lenv* f = e; f; f = f->up) { frames[n++] = f; }
+  while (n--) {
+    for (int i = 0; i < frames[n]->count; i++) {
+      lser_put_sym(out, frames[n]->syms[i]);
+      lser_put_lval(out, frames[n]->vals[i]);
+    }
+  }
+  free(frames);
+}
+
+void lser_put_env(lser_out* out, lenv* e) {
+  /* Captured frames are flattened, as reading binds each in turn */
+  int count = 0;
+  for (lenv* f = e; f; f = f->up) { count += f->count; }
+  lser_put_uint(out, count);
+  lser_put_frames(out, e);
+}
+
+void lser_put_lval(lser_out* out, lval* v) {
+  /* Nested no deeper than lser_get_lval reads, else nothing more is written */
+  /* and the encoding is left unfinished, see 'too_deep' */
+  if (out->too_deep) { return; }
+  if (out->depth == LSER_MAX_DEPTH) {
+    out->too_deep = 1;
+    return;
+  }
+  out->depth++;
+  lser_put_value(out, v);
+  out->depth--;
+}
+
+void lser_put_value(lser_out* out, lval* v) {
+  /* Numbers have no identity worth keeping */
+  if (LTYPE(v) == LVAL_NUM) {
+    lser_put_tag(out, LSER_NUM);
+    lser_put_int(out, LNUM(v));
+    return;
+  }
+
+  int id = lser_table_id(&out->vals, v);
+  if (id >= 0) {
+    lser_put_tag(out, LSER_REF);
+    lser_put_uint(out, id);
+    return;
+  }
+
+  switch (v->type) {
+    case LVAL_ERR:  lser_put_tag(out, LSER_ERR); lser_put_str(out, v->err); break;
+    case LVAL_SYM:  lser_put_tag(out, LSER_SYM); lser_put_sym(out, v->sym); break;
+    case LVAL_STR:  lser_put_tag(out, LSER_STR); lser_put_str(out, v->str); break;
+    case LVAL_TERM: lser_put_tag(out, LSER_TERM);                           break;
+
+    /* Futures are written as their values, once done */
+    case LVAL_FUT: {
+      /* In its place, so at the depth it is read back at */
+      lval* x = lpar_await(v);
+      lser_put_value(out, x);
+      lval_del(x);
+      break;
+    }
+
+    /* Builtins by name, lambdas by what they were built from */
+    case LVAL_FUN:
+      if (v->builtin) {
+        char* name = lbuiltin_name(v->builtin);
+        lser_put_tag(out, LSER_BUILTIN);
+        lser_put_sym(out, name ? name : lsym_intern(""));
+      } else {
+        lser_put_tag(out, LSER_LAMBDA);
+        lser_put_env(out, v->env);
+        lser_put_lval(out, v->formals);
+        lser_put_lval(out, v->body);
+      }
+      break;
+
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      lser_put_tag(out, v->type == LVAL_SEXPR ? LSER_SEXPR : LSER_QEXPR);
+      lser_put_uint(out, v->count);
+      for (int i = 0; i < v->count; i++) {
+        lser_put_lval(out, v->cell[i]);
+      }
+      break;
+  }
+}
+
+void lser_out_begin(lser_out* out, char* magic) {
+  /* Every encoding starts with what it holds and the version it is in */
+  memset(out, 0, sizeof(lser_out));
+  lser_put_bytes(out, magic, LSER_MAGIC_SIZE);
+  lser_put_uint(out, LSER_VERSION);
+}
+
+void lser_out_end(lser_out* out) {
+  free(out->vals.keys);  free(out->vals.ids);
+  free(out->syms.keys);  free(out->syms.ids);
+}
+
+char* lval_serialize(lval* v, long* n) {
+  /* Encoding of 'v' and its size in 'n', to be freed by the caller */
+  /* NULL if 'v' is nested too deeply to be read back */
+  lser_out out;
+  lser_out_begin(&out, LSER_MAGIC);
+  lser_put_lval(&out, v);
+  lser_out_end(&out);
+  if (out.too_deep) {
+    free(out.data);
+    *n = 0;
+    return NULL;
+  }
+  *n = out.count;
+  return out.data;
+}
+
+/* Reading */
+
+int lser_get_uint(lser_in* in, unsigned long* x) {
+  *x = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (in->p == in->end) { return 0; }
+    unsigned char b = *in->p++;
+    *x |= (unsigned long)(b & 0x7f) << shift;
+    if (!(b & 0x80)) { return 1; }
+  }
+  return 0;
+}
+
+int lser_get_int(lser_in* in, long* x) {
+  unsigned long u;
+  if (!lser_get_uint(in, &u)) { return 0; }
+  *x = (long)(u >> 1) ^ -(long)(u & 1);
+  return 1;
+}
+
+char* lser_get_str(lser_in* in, long* n) {
+  /* Pointer into the encoding itself, not terminated */
+  unsigned long u;
+  if (!lser_get_uint(in, &u) || u > (unsigned long)(in->end - in->p)) { return NULL; }
+  char* s = in->p;
+  in->p += u;
+  *n = u;
+  return s;
+}
+
+char* lser_get_sym(lser_in* in) {
+  /* Interned name, read from the stream when first seen */
+  unsigned long id;
+  if (!lser_get_uint(in, &id) || id > (unsigned long)in->nsyms) { return NULL; }
+  if (id < (unsigned long)in->nsyms) { return in->syms[id]; }
+
+  long n;
+  char* s = lser_get_str(in, &n);
+  if (!s) { return NULL; }
+  in->syms = realloc(in->syms, sizeof(char*) * (in->nsyms + 1));
+  in->syms[in->nsyms++] = lsym_intern_n(s, n);
+  return in->syms[id];
+}
+
+int lser_record(lser_in* in, lval* v, int done) {
+  /* Remember 'v' for later references, before reading what it holds */
+  /* Lists cannot be referred to until 'done', so they never hold themselves */
+  if (in->count == in->capacity) {
+    in->capacity = in->capacity ? in->capacity * 2 : 256;
+    in->seen = realloc(in->seen, sizeof(lval*) * in->capacity);
+    in->done = realloc(in->done, in->capacity);
+  }
+  in->seen[in->count] = v;
+  in->done[in->count] = done;
+  return in->count++;
+}
+
+int lser_get_env(lser_in* in, lenv* e) {
+  unsigned long count;
+  if (!lser_get_uint(in, &count)) { return 0; }
+  for (unsigned long i = 0; i < count; i++) {
+    char* sym = lser_get_sym(in);
+    if (!sym) { return 0; }
+    lval* v = lser_get_lval(in);
+    if (!v) { return 0; }
+
+    /* Only the name of a key is read */
+    lval k;
+    k.sym = sym;
+    lfold_bind(sym, v);
+    lenv_put(e, &k, v);
+    lval_del(v);
+  }
+  return 1;
+}
+
+lval* lser_get_lval(lser_in* in) {
+  /* Next value in the encoding, or NULL if it is malformed */
+  /* Nesting is bounded, so a crafted encoding cannot exhaust the C stack */
+  if (in->depth == LSER_MAX_DEPTH) {
+    in->too_deep = 1;
+    return NULL;
+  }
+  in->depth++;
+  lval* v = lser_get_value(in);
+  in->depth--;
+  return v;
+}
+
+lval* lser_get_value(lser_in* in) {
+  /* Next value in the encoding, reading what it holds through lser_get_lval */
+  if (in->p == in->end) { return NULL; }
+  int tag = (unsigned char)*in->p++;
+
+  long x, n;
+  unsigned long id;
+  char* s;
+  lval* v;
+  switch (tag) {
+    case LSER_NUM:
+      return lser_get_int(in, &x) ? lval_num(x) : NULL;
+
+    case LSER_REF:
+      if (!lser_get_uint(in, &id) || id >= (unsigned long)in->count) { return NULL; }
+      if (!in->done[id]) { return NULL; }
+      return lval_retain(in->seen[id]);
+
+    case LSER_ERR:
+      if (!(s = lser_get_str(in, &n))) { return NULL; }
+      v = lval_err("%.*s", (int)n, s);
+      lser_record(in, v, 1);
+      return v;
+
+    case LSER_SYM:
+      if (!(s = lser_get_sym(in))) { return NULL; }
+      v = lval_alloc();
+      v->type = LVAL_SYM;
+      v->ref = 1;
+      v->sym = s;
+      lser_record(in, v, 1);
+      return v;
+
+    case LSER_STR:
+      if (!(s = lser_get_str(in, &n))) { return NULL; }
+      v = lval_alloc();
+      v->type = LVAL_STR;
+      v->ref = 1;
+      v->str = malloc(n + 1);
+      memcpy(v->str, s, n);
+      v->str[n] = '\0';
+      lser_record(in, v, 1);
+      return v;
+
+    case LSER_TERM:
+      v = lval_term();
+      lser_record(in, v, 1);
+      return v;
+
+    case LSER_BUILTIN: {
+      if (!(s = lser_get_sym(in))) { return NULL; }
+      lbuiltin func = lbuiltin_find(s);
+      if (!func) { return NULL; }
+      v = lval_builtin(func);
+      lser_record(in, v, 1);
+      return v;
+    }
+
+    case LSER_LAMBDA: {
+      /* Stand-ins keep 'v' whole until its parts are read */
+      v = lval_lambda(lval_qexpr(), lval_qexpr());
+      lser_record(in, v, 1);
+      if (!lser_get_env(in, v->env)) { lval_del(v); return NULL; }
+
+      /* Formals are a list of symbols and the body a list, as for '\\' */
+      lval* formals = lser_get_lval(in);
+      int valid = formals && LTYPE(formals) == LVAL_QEXPR;
+      for (int i = 0; valid && i < formals->count; i++) {
+        valid = LTYPE(formals->cell[i]) == LVAL_SYM;
+      }
+      if (!valid) {
+        if (formals) { lval_del(formals); }
+        lval_del(v);
+        return NULL;
+      }
+      lval_del(v->formals);
+      v->formals = formals;
+
+      lval* body = lser_get_lval(in);
+      if (body && LTYPE(body) != LVAL_QEXPR) {
+        lval_del(body);
+        body = NULL;
+      }
+      if (!body) { lval_del(v); return NULL; }
+      lval_del(v->body);
+      v->body = body;
+      lval_compile_in(v->body, v->formals);
+      if (!v->body->code) { lval_del(v); return NULL; }
+      return v;
+    }
+
+    case LSER_SEXPR:
+    case LSER_QEXPR:
+      v = tag == LSER_SEXPR ? lval_sexpr() : lval_qexpr();
+      int k = lser_record(in, v, 0);
+      if (!lser_get_uint(in, &id)) { lval_del(v); return NULL; }
+      /* Each element takes at least a byte */
+      if (id > (unsigned long)(in->end - in->p) || id > INT_MAX) {
+        lval_del(v);
+        return NULL;
+      }
+      lval_reserve(v, id);
+      for (unsigned long i = 0; i < id; i++) {
+        lval* x = lser_get_lval(in);
+        if (!x) { lval_del(v); return NULL; }
+        v->cell[v->count++] = x;
+      }
+      in->done[k] = 1;
+      return v;
+  }
+
+  return NULL;
+}
+
+int lser_in_begin(lser_in* in, char* magic, char* src, long n) {
+  /* Check what the encoding holds and that its version is understood */
+  memset(in, 0, sizeof(lser_in));
+  in->p = src;
+  in->end = src + n;
+  if (n < LSER_MAGIC_SIZE || memcmp(src, magic, LSER_MAGIC_SIZE) != 0) { return 0; }
+  in->p += LSER_MAGIC_SIZE;
+
+  unsigned long version;
+  return lser_get_uint(in, &version) && version == LSER_VERSION;
+}
+
+void lser_in_end(lser_in* in) {
+  free(in->seen);
+  free(in->done);
+  free(in->syms);
+}
+
+lval* lval_deserialize(char* src, long n) {
+  /* Value encoded in the 'n' bytes at 'src' by 'lval_serialize' */
+  lser_in in;
+  lval* v = NULL;
+  if (lser_in_begin(&in, LSER_MAGIC, src, n)) {
+    v = lser_get_lval(&in);
+    if (v && in.p != in.end) {
+      lval_del(v);
+      v = NULL;
+    }
+  }
+  int too_deep = in.too_deep;
+  lser_in_end(&in);
+
+  if (!v && too_deep) {
+    return lval_err("Could not deserialize: nested deeper than %i", LSER_MAX_DEPTH);
+  }
+  return v ? v : lval_err("Could not deserialize: not a version %i encoding",
+    LSER_VERSION);
+}
+
+/* Images of the global environment, see 'save-image' and '--image' */
+
+lval* limage_save(lenv* e, char* path) {
+  /* Write all bindings of 'e' to the image at 'path' */
+  /* Copied first, as writing futures waits for tasks that may 'def' */
+  lenv* copy = lenv_snapshot(e);
+
+  lser_out out;
+  lser_out_begin(&out, LIMAGE_MAGIC);
+  lser_put_env(&out, copy);
+  lser_out_end(&out);
+  lenv_del(copy);
+
+  /* An image '--image' would refuse is not written at all */
+  if (out.too_deep) {
+    free(out.data);
+    return lval_err("Could not write image '%s': nested deeper than %i",
+      path, LSER_MAX_DEPTH);
+  }
+  lval* x = lfile_write(path, out.data, out.count);
+  free(out.data);
+  return x;
+}
+
+lval* limage_load(lenv* e, char* path) {
+  /* Put all bindings of the image at 'path' into 'e' */
+  long n;
+  char* src = lfile_map(path, &n);
+  if (!src) {
+    return lval_err("Could not load image '%s': %s", path, strerror(errno));
+  }
+
+  lser_in in;
+  int ok = lser_in_begin(&in, LIMAGE_MAGIC, src, n)
+    && lser_get_env(&in, e) && in.p == in.end;
+  int too_deep = in.too_deep;
+  lser_in_end(&in);
+
+  lfile_unmap(src, n);
+  if (!ok && too_deep) {
+    return lval_err("Could not load image '%s': nested deeper than %i",
+      path, LSER_MAX_DEPTH);
+  }
+  if (!ok) {
+    return lval_err("Could not load image '%s': not a version %i image",
+      path, LSER_VERSION);
+  }
+  return lval_sexpr();
+}
+
+/**
+ * Scheduler
+ * 
+ * 'spawn' and the parallel builtins queue tasks on the deque of the
+ * calling thread, run by a fixed pool of worker threads which steal from
+ * each other when their own runs dry. Threads waiting on a task run
+ * others meanwhile. Short lists, and everything when there are no
+ * workers, run in the calling thread instead
+ */
+
+static int lpar_threads = LPAR_THREADS;   /* Threads wanted including the caller, see '--threads' */
+static __thread lenv* lpar_env = NULL;    /* Environment of the running chunk, read-only */
+
+#ifndef _WIN32
+static int lpar_nworkers = 0;
+static int lpar_ndeques = 0;              /* Set before the workers start */
+static lpar_deque lpar_deques[LPAR_MAX_THREADS];
+static __thread int lpar_self = 0;        /* Deque of this thread, 0 unless a worker */
+static __thread int lpar_running = 0;     /* Tasks this thread is in the middle of */
+static int lpar_queued = 0;               /* Tasks in all deques */
+static int lpar_sleeping = 0;             /* Threads waiting on lpar_woken */
+static pthread_mutex_t lpar_sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lpar_woken = PTHREAD_COND_INITIALIZER;  /* A task was queued or finished */
+#endif
+
+int lpar_shared(lenv* e) {
+  /* Whether 'e' may be read by other calls of the parallel builtin running */
+  /* this one, also when these happen to run in this thread, so results do */
+  /* not differ. The global environment is published atomically instead */
+  if (e == lenv_global) { return 0; }
+  for (lenv* x = lpar_env; x; x = x->par) {
+    if (x == e) { return 1; }
+  }
+  return 0;
+}
+
+int lpar_failed(lval* v) {
+  return LTYPE(v) == LVAL_ERR || LTYPE(v) == LVAL_TERM;
+}
+
+void lpar_fail(lpar_job* job, int i) {
+  /* Record failure at 'i', keeping the first so results do not depend on timing */
+  int failed = __atomic_load_n(&job->failed, __ATOMIC_ACQUIRE);
+  while (i < failed && !__atomic_compare_exchange_n(&job->failed, &failed, i,
+    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {}
+}
+
+lval* lpar_call(lpar_job* job, lval* x, lval* y) {
+  /* Apply the function of 'job' to 'x' and 'y' if any, consuming them */
+  lval* a = lval_add(lval_sexpr(), x);
+  if (y) { lval_add(a, y); }
+  return lval_call(job->env, job->f, a, NULL);
+}
+
+void lpar_chunk(lpar_job* job, int k) {
+  /* Run chunk 'k' of 'job', leaving a result per element or per chunk in 'out' */
+  /* Elements after a failure are skipped */
+  lval** cell = job->list->cell;
+  int from = k * job->chunk;
+  int to = from + job->chunk;
+  if (to > job->list->count) { to = job->list->count; }
+
+  /* Calls stay within the environment of the job */
+  lenv* env = lpar_env;
+  lpar_env = job->env;
+
+  if (job->kind == LPAR_REDUCE) {
+    /* The first chunk starts from the initial value, others from their first element */
+    lval* acc = lval_retain(k == 0 ? job->init : cell[from++]);
+    for (int i = from; i < to && !lpar_failed(acc); i++) {
+      if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED) < k) { break; }
+      acc = lpar_call(job, acc, lval_retain(cell[i]));
+    }
+    job->out[k] = acc;
+    if (lpar_failed(acc)) { lpar_fail(job, k); }
+    lpar_env = env;
+    return;
+  }
+
+  for (int i = from; i < to; i++) {
+    if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED) < i) { break; }
+    lval* x = lpar_call(job, lval_retain(cell[i]), NULL);
+    if (job->kind == LPAR_FILTER && LTYPE(x) != LVAL_NUM && !lpar_failed(x)) {
+      int t = LTYPE(x);
+      lval_del(x);
+      x = lval_err("Function 'pfilter' passed function returning %s, Expected %s.",
+        ltype_name(t), ltype_name(LVAL_NUM));
+    }
+    job->out[i] = x;
+    if (lpar_failed(x)) { lpar_fail(job, i); }
+  }
+  lpar_env = env;
+}
+
+#ifndef _WIN32
+void lpar_push(lpar_task* t) {
+  /* Queue 't' on the deque of this thread, counting it until it is run */
+  __atomic_add_fetch(&lpar_active, 1, __ATOMIC_ACQ_REL);
+  t->out = lval_out;
+  if (t->out) { __atomic_add_fetch(&t->out->tasks, 1, __ATOMIC_SEQ_CST); }
+
+  lpar_deque* d = &lpar_deques[lpar_self];
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom - d->top == d->capacity) {
+    /* Grow the ring, unwrapping it */
+    long capacity = d->capacity ? d->capacity * 2 : 64;
+    lpar_task* tasks = malloc(sizeof(lpar_task) * capacity);
+    for (long i = d->top; i < d->bottom; i++) {
+      tasks[i & (capacity - 1)] = d->tasks[i & (d->capacity - 1)];
+    }
+    free(d->tasks);
+    d->tasks = tasks;
+    d->capacity = capacity;
+  }
+  d->tasks[d->bottom++ & (d->capacity - 1)] = *t;
+  pthread_mutex_unlock(&d->lock);
+
+  __atomic_add_fetch(&lpar_queued, 1, __ATOMIC_SEQ_CST);
+  lpar_wake();
+}
+
+int lpar_take(lpar_task* t) {
+  /* Take the newest task of this thread, else steal the oldest of another */
+  int n = lpar_ndeques;
+  for (int i = 0; i < n; i++) {
+    lpar_deque* d = &lpar_deques[(lpar_self + i) % n];
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top) {
+      *t = i == 0 ? d->tasks[--d->bottom & (d->capacity - 1)]
+                  : d->tasks[d->top++ & (d->capacity - 1)];
+      pthread_mutex_unlock(&d->lock);
+      __atomic_sub_fetch(&lpar_queued, 1, __ATOMIC_SEQ_CST);
+      return 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+  }
+  return 0;
+}
+
+void lpar_wake(void) {
+  /* Wake waiting threads to look again, if there are any */
+  if (__atomic_load_n(&lpar_sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&lpar_sleep_mutex);
+    pthread_cond_broadcast(&lpar_woken);
+    pthread_mutex_unlock(&lpar_sleep_mutex);
+  }
+}
+
+void lpar_wait(int* pending) {
+  /* Sleep until a task is queued, or '*pending' (if any) drops to zero */
+  /* Counting sleepers first, so a task queued meanwhile is seen or wakes us */
+  pthread_mutex_lock(&lpar_sleep_mutex);
+  __atomic_add_fetch(&lpar_sleeping, 1, __ATOMIC_SEQ_CST);
+  while (!__atomic_load_n(&lpar_queued, __ATOMIC_SEQ_CST)
+    && !(pending && !__atomic_load_n(pending, __ATOMIC_SEQ_CST))) {
+    pthread_cond_wait(&lpar_woken, &lpar_sleep_mutex);
+  }
+  __atomic_sub_fetch(&lpar_sleeping, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&lpar_sleep_mutex);
+}
+#endif
+
+void lpar_finish(int* pending) {
+  /* Count down '*pending', waking its waiters at zero */
+  if (__atomic_sub_fetch(pending, 1, __ATOMIC_SEQ_CST) == 0) {
+#ifndef _WIN32
+    lpar_wake();
+#endif
+  }
+}
+
+#ifndef _WIN32
+void lpar_exec(lpar_task* t) {
+  /* Run 't' taken off a deque, then stop counting it */
+  /* Its job may be gone once its last chunk is counted down */
+  /* It prints where the thread queuing it did, see lout_close */
+  lout_stream* out = lval_out;
+  lval_out = t->out;
+  lpar_running++;
+  if (t->session) {
+    lsrv_eval(t->session);
+  } else if (t->fut) {
+    lpar_resolve(t->fut);
+    lval_del(t->fut);
+  } else {
+    lpar_chunk(t->job, t->chunk);
+    lpar_finish(&t->job->pending);
+  }
+  lpar_running--;
+  lval_out = out;
+  if (t->out) { lpar_finish(&t->out->tasks); }
+
+  /* Free nodes of a thread about to go idle would be stranded there */
+  if (!__atomic_load_n(&lpar_queued, __ATOMIC_ACQUIRE)) { lpool_return(); }
+  lpar_finish(&lpar_active);
+}
+
+void lpar_help(int* pending) {
+  /* Run queued tasks until '*pending' drops to zero, sleeping when there are none */
+  lpar_task t;
+  while (__atomic_load_n(pending, __ATOMIC_ACQUIRE)) {
+    if (lpar_take(&t)) {
+      lpar_exec(&t);
+    } else {
+      lpar_wait(pending);
+    }
+  }
+}
+
+void* lpar_worker(void* arg) {
+  lpar_self = (int)(intptr_t)arg;
+  lpar_task t;
+  for (;;) {
+    if (lpar_take(&t)) {
+      lpar_exec(&t);
+    } else {
+      lpar_wait(NULL);
+    }
+  }
+  return NULL;
+}
+#endif
+
+int lpar_workers(void) {
+  /* Start the worker threads on first use, returning how many there are */
+#ifdef _WIN32
+  return 0;
+#else
+  if (lpar_nworkers == 0 && lpar_threads != 1) {
+    int n = lpar_threads > 0 ? lpar_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > LPAR_MAX_THREADS) { n = LPAR_MAX_THREADS; }
+    for (int i = 0; i < n; i++) {
+      pthread_mutex_init(&lpar_deques[i].lock, NULL);
+    }
+    lpar_ndeques = n;
+    for (int i = 1; i < n; i++) {
+      pthread_t t;
+      if (pthread_create(&t, NULL, lpar_worker, (void*)(intptr_t)i) != 0) { break; }
+      pthread_detach(t);
+      lpar_nworkers++;
+    }
+    /* Do not try again if none could start */
+    if (lpar_nworkers == 0) { lpar_threads = 1; }
+  }
+  return lpar_nworkers;
+#endif
+}
+
+void lpar_resolve(lval* fut) {
+  /* Apply the call of 'fut' in the global environment, publishing the result */
+  lenv* env = lpar_env;
+  lpar_env = NULL;
+
+  lval* a = fut->call;
+  fut->call = NULL;
+  lval* f = lval_pop(a, 0);
+  fut->value = lval_call(lenv_global, f, a, NULL);
+  lval_del(f);
+
+  lpar_env = env;
+  lpar_finish(&fut->pending);
+}
+
+lval* lpar_await(lval* fut) {
+  /* Value of 'fut', running other tasks until it is done */
+#ifndef _WIN32
+  lpar_help(&fut->pending);
+#endif
+  return lval_retain(fut->value);
+}
+
+lval* lpar_collect(lpar_job* job) {
+  /* Result of finished 'job' from its results in 'out', which are released */
+  int n = job->kind == LPAR_REDUCE ? job->nchunks : job->list->count;
+  lval* x;
+
+  if (job->failed < n) {
+    x = lval_retain(job->out[job->failed]);
+  } else if (job->kind == LPAR_REDUCE) {
+    /* Chunks combine in order, as the function need only be associative */
+    x = lval_retain(job->out[0]);
+    for (int k = 1; k < n && !lpar_failed(x); k++) {
+      x = lpar_call(job, x, lval_retain(job->out[k]));
+    }
+  } else {
+    x = lval_qexpr();
+    lval_reserve(x, n);
+    for (int i = 0; i < n; i++) {
+      if (job->kind == LPAR_MAP) {
+        x->cell[x->count++] = lval_retain(job->out[i]);
+      } else if (LNUM(job->out[i])) {
+        x->cell[x->count++] = lval_retain(job->list->cell[i]);
+      }
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (job->out[i]) { lval_del(job->out[i]); }
+  }
+  free(job->out);
+  return x;
+}
+
+lval* lpar_run(int kind, lenv* e, lval* f, lval* init, lval* list) {
+  /* Apply 'f' over 'list' as a job of 'kind', from 'init' when reducing */
+  int n = list->count;
+  lpar_job job;
+  job.kind = kind;
+  job.env = e;
+  job.f = f;
+  job.init = init;
+  job.list = list;
+  job.failed = INT_MAX;
+
+  /* A few chunks per thread, none shorter than LPAR_CHUNK */
+  job.nchunks = 1;
+  job.chunk = n > 0 ? n : 1;
+  int parallel = n >= 2 * LPAR_CHUNK && lpar_workers() > 0;
+  if (parallel) {
+    int most = (lpar_workers() + 1) * 4;
+    job.nchunks = n / LPAR_CHUNK < most ? n / LPAR_CHUNK : most;
+    job.chunk = (n + job.nchunks - 1) / job.nchunks;
+    job.nchunks = (n + job.chunk - 1) / job.chunk;
+  }
+  job.out = calloc(kind == LPAR_REDUCE ? job.nchunks : (n > 0 ? n : 1), sizeof(lval*));
+
+  job.pending = job.nchunks;
+
+  /* Queue all chunks but the first, which runs here before helping with the rest */
+#ifndef _WIN32
+  if (parallel) {
+    for (int k = 1; k < job.nchunks; k++) {
+      lpar_task t = { NULL, &job, k, NULL, NULL };
+      lpar_push(&t);
     }
+    lpar_chunk(&job, 0);
+    lpar_finish(&job.pending);
+    lpar_help(&job.pending);
+    return lpar_collect(&job);
+  }
+#endif
+  for (int k = 0; k < job.nchunks; k++) {
+    lpar_chunk(&job, k);
+  }
+  return lpar_collect(&job);
+}
 
-    /* Incrementally grab formal and argument pair */
-    lval* sym = lval_pop(f->formals, 0);
+/**
+ * Server
+ * 
+ * Clients connect to a Unix socket and send lines as if typed at the
+ * prompt, each getting back what its line printed and then its value.
+ * Sessions have environments of their own below the global one, sealed
+ * once libraries are loaded, and their lines run as tasks of the
+ * scheduler while the main thread polls the sockets
+ */
 
-    /* Variably-long Arguments: 'x & xs' */
-    /* If 'sym' is variable argument operator '&' */
-    if (strcmp(sym->sym, "&") == 0) {
-      /* Ensure '&' is followed by one more symbol in 'formals' */
-      if (f->formals->count != 1) {
-        lval_del(a);
-        return lval_err("Function format invalid. "
-          "Symbol '&' not followed by single symbol.");
-      }
+#ifndef _WIN32
+static volatile sig_atomic_t lsrv_stopping = 0;
+static int lsrv_pipe[2] = { -1, -1 };   /* Wakes the main thread once a line is done */
 
-      /* Bind that list of formals to the tail of arguments */
-      lval* nsym = lval_pop(f->formals, 0);
-      lenv_put(f->env, nsym, builtin_list(e, a));
-      lval_del(sym);  lval_del(nsym);
+void lsrv_stop(int sig) {
+  int saved = errno;
+  lsrv_stopping = 1;
+  ssize_t r = write(lsrv_pipe[1], "", 1);
+  (void)r;
+  errno = saved;
+}
 
-      /* First pass in loop, can immediately break */
-      break;
+lsrv_session* lsrv_open(int fd) {
+  lsrv_session* s = calloc(1, sizeof(lsrv_session));
+  s->fd = fd;
+  s->env = lenv_new();
+  s->env->par = lenv_global;
+  return s;
+}
+
+void lsrv_close(lsrv_session* s) {
+  close(s->fd);
+  lenv_del(s->env);
+  free(s->in);
+  free(s);
+}
+
+int lsrv_take(lsrv_session* s) {
+  /* Move every complete line read from 's' into 'lines', if there are any, */
+  /* so lines sent without waiting for replies are evaluated together */
+  long n = s->count;
+  while (n > 0 && s->in[n - 1] != '\n') { n--; }
+  if (n == 0) {
+    /* A client never ending its line is not waited on */
+    if (s->count > LSRV_MAX_LINE) {
+      s->count = 0;
+      s->closing = 1;
     }
+    return 0;
+  }
 
-    /* Incrementally grab formal and argument pair */
-    lval* val = lval_pop(a, 0);
+  s->lines = malloc(n + 1);
+  memcpy(s->lines, s->in, n);
+  s->lines[n] = '\0';
+  s->count -= n;
+  memmove(s->in, s->in + n, s->count);
+  return 1;
+}
 
-    /* Bind the pair in 'f''s env, then get deleted */
-    lenv_put(f->env, sym, val);
-    lval_del(sym);  lval_del(val);
+void lsrv_reply(int fd, char* data, long n) {
+  /* Write all 'n' bytes, giving up on a client that has gone */
+  while (n > 0) {
+    ssize_t w = send(fd, data, n, MSG_NOSIGNAL);
+    if (w < 0 && errno == EINTR) { continue; }
+    if (w <= 0) { return; }
+    data += w;
+    n -= w;
   }
-  /* Argument list is completely bound */
-  lval_del(a);
+}
 
-  /* Variably-long Formals are not satuated with variably-long Arguments */
-  /* Handles this case only: (\ {x & w} {...}) x' -> {...}[x = x', w = {}] */
-  /* (\ {x y & w} {...}) x' -> \ {y & w} {...[x = x']} */
-  /* (\ {x y z} {...} x') -> \ {y z} {...[x = x']} */
-  if (f->formals->count > 0 &&
-    strcmp(f->formals->cell[0]->sym, "&") == 0) {
-    
-    /* Guard that '& xs' is not followed */
-    if (f->formals->count != 2) {
-      return lval_err("Function format invalid. "
-        "Symbol '&' not followed by single symbol");
+void lsrv_eval(lsrv_session* s) {
+  /* Evaluate the lines taken from 's', replying in one write with */
+  /* everything printed meanwhile and their values */
+  /* Each line is read on its own as at the prompt, however they arrived */
+  lval* exprs = lval_sexpr();
+  for (char* p = s->lines; *p; ) {
+    char* end = strchr(p, '\n');
+    *end = '\0';
+    exprs = lval_add(exprs, lval_read_str("<client>", p));
+    p = end + 1;
+  }
+  free(s->lines);
+  s->lines = NULL;
+
+  lout_stream out;
+  lout_open(&out);
+  s->term = lval_eval_batch(s->env, exprs);
+  lout_close(&out);
+  lsrv_reply(s->fd, out.data, out.count);
+  free(out.data);
+
+  /* Hand the session back to the main thread, then wake it */
+  __atomic_store_n(&s->busy, 0, __ATOMIC_RELEASE);
+  ssize_t r = write(lsrv_pipe[1], "", 1);
+  (void)r;
+}
+#endif
+
+int lsrv_run(lenv* e, char* path) {
+  /* Serve sessions on socket 'path' until interrupted, over environment 'e' */
+#ifdef _WIN32
+  fprintf(stderr, "Could not serve on '%s': unsupported\n", path);
+  return 1;
+#else
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Could not serve on '%s': path too long\n", path);
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+
+  unlink(path);
+  int srv = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (srv < 0 || bind(srv, (struct sockaddr*)&addr, sizeof(addr)) < 0
+    || listen(srv, SOMAXCONN) < 0 || pipe(lsrv_pipe) < 0) {
+    fprintf(stderr, "Could not serve on '%s': %s\n", path, strerror(errno));
+    if (srv >= 0) { close(srv); }
+    return 1;
+  }
+  fcntl(lsrv_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(lsrv_pipe[1], F_SETFL, O_NONBLOCK);
+
+  /* Interrupting poll stops the server rather than restarting it */
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = lsrv_stop;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  /* Sessions share the bindings loaded so far, defining their own */
+  lenv_sealed = 1;
+  int parallel = lpar_workers() > 0;
+
+  int count = 0;
+  int capacity = 16;
+  lsrv_session** sessions = malloc(sizeof(lsrv_session*) * capacity);
+  struct pollfd* fds = malloc(sizeof(struct pollfd) * (capacity + 2));
+
+  while (!lsrv_stopping) {
+    /* Start the lines of each idle session, closing those that are done */
+    for (int i = 0; i < count; i++) {
+      lsrv_session* s = sessions[i];
+      if (__atomic_load_n(&s->busy, __ATOMIC_ACQUIRE)) { continue; }
+      if (!s->term && lsrv_take(s)) {
+        s->busy = 1;
+        if (parallel) {
+          lpar_task t = { NULL, NULL, 0, s, NULL };
+          lpar_push(&t);
+        } else {
+          lsrv_eval(s);
+        }
+      } else if (s->term || s->closing) {
+        lsrv_close(s);
+        sessions[i--] = sessions[--count];
+      }
     }
-    /* Post condition:  */
 
-    /* Pop and delete redundant '&' */
-    lval_del(lval_pop(f->formals, 0));
+    /* Wait for clients, and for lines being evaluated */
+    fds[0].fd = srv;
+    fds[0].events = POLLIN;
+    fds[1].fd = lsrv_pipe[0];
+    fds[1].events = POLLIN;
+    for (int i = 0; i < count; i++) {
+      fds[i + 2].fd = sessions[i]->closing ? -1 : sessions[i]->fd;
+      fds[i + 2].events = POLLIN;
+    }
+    int polled = count;
+    if (poll(fds, polled + 2, -1) < 0) {
+      if (errno == EINTR) { continue; }
+      fprintf(stderr, "Could not poll: %s\n", strerror(errno));
+      break;
+    }
 
-    /* Pop next symbol and create an empty list */
-    lval* sym = lval_pop(f->formals, 0);
-    lval* val = lval_qexpr();
+    if (fds[1].revents) {
+      char buf[64];
+      while (read(lsrv_pipe[0], buf, sizeof(buf)) > 0) {}
+    }
 
-    /* Bind this pair in env and delete */
-    lenv_put(f->env, sym, val);
-    lval_del(sym);  lval_del(val);
-  }
+    /* Read what clients sent, an end or error closing the session */
+    for (int i = 0; i < polled; i++) {
+      if (!fds[i + 2].revents) { continue; }
+      lsrv_session* s = sessions[i];
+      if (s->capacity - s->count < 4096) {
+        s->capacity = s->capacity ? s->capacity * 2 : 8192;
+        s->in = realloc(s->in, s->capacity);
+      }
+      ssize_t r = read(s->fd, s->in + s->count, s->capacity - s->count);
+      if (r > 0) {
+        s->count += r;
+      } else if (r == 0 || errno != EINTR) {
+        s->closing = 1;
+      }
+    }
 
-  /* If formals are all bound, do evaluate */
-  if (f->formals->count == 0) {
-    /* Set the parent env, the largest scope for evaluation, as 'e', so as to define most variables */
-    f->env->par = e;
-    return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-  } else {
-    /* Otherwise return partially applied function */
-    return lval_copy(f);
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(srv, NULL, NULL);
+      if (fd >= 0) {
+        if (count == capacity) {
+          capacity *= 2;
+          sessions = realloc(sessions, sizeof(lsrv_session*) * capacity);
+          fds = realloc(fds, sizeof(struct pollfd) * (capacity + 2));
+        }
+        sessions[count++] = lsrv_open(fd);
+      }
+    }
   }
 
+  /* Let lines being evaluated finish, then close every session */
+  lpar_help(&lpar_active);
+  for (int i = 0; i < count; i++) {
+    lsrv_close(sessions[i]);
+  }
+  free(sessions);
+  free(fds);
+  close(srv);
+  close(lsrv_pipe[0]);
+  close(lsrv_pipe[1]);
+  unlink(path);
+  lenv_sealed = 0;
+  return 0;
+#endif
 }
 
-
 /**
  * Builtins
  *  
@@ -676,94 +3704,100 @@ lval* lval_call(lenv* e, lval* f, lval* a) {
  * Instead of primitive symbols
  */
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
+/* Names of operators, indexed by LOP_* */
+char* lop_names[] = { "+", "-", "*", "/", "%", "^", "min", "max",
+                      ">", "<", ">=", "<=", "==", "!=" };
+
+lval* builtin_op(lenv* e, lval* a, int op) {
   /* Apply op on variably long lval a */
   /* Upgrade from 2-argument eval_op */
 
   /* Ensure all arguments are numbers */
   for (int i = 0; i < a->count; i++) {
     lval* c = a->cell[i];
-    if (c->type != LVAL_NUM) {
+    if (LTYPE(c) != LVAL_NUM) {
       /* Abort evaluation by shortcircuiting to deallocating memory */
       lval_del(a);
       return lval_err("Cannot operate on non-number!");
     }
   }
-
-  /* Pop first argument */
-  lval* x = lval_pop(a, 0);
-
-  /* Unitary negation */
-  if ((strcmp(op, "-") == 0) && (a->count == 0)) {
-    /* If op is minus and after two pops there remain no more elements, i.e. a 2-element cell */
-    x->num = -x->num;
+  if (a->count == 0) {
+    lval_del(a);
+    return lval_err("Function '%s' passed no arguments.", lop_names[op]);
   }
 
-  /* (+ 9) */
-  /* (- 1) will skip this block */
-
-  /* While there is still elements on the list */
-  while (a->count > 0) {
-
-    /* Pop the next element */
-    lval* y = lval_pop(a, 0);
+  /* Fold the operator over the cells in place, first argument accumulates */
+  lval** cell = a->cell;
+  int n = a->count;
+  long x = LNUM(cell[0]);
+
+  switch (op) {
+    case LOP_ADD: for (int i = 1; i < n; i++) { x += LNUM(cell[i]); } break;
+    case LOP_MUL: for (int i = 1; i < n; i++) { x *= LNUM(cell[i]); } break;
+    case LOP_EXP: for (int i = 1; i < n; i++) { x = pow(x, LNUM(cell[i])); } break;
+    case LOP_MIN: for (int i = 1; i < n; i++) { x = fmin(x, LNUM(cell[i])); } break;
+    case LOP_MAX: for (int i = 1; i < n; i++) { x = fmax(x, LNUM(cell[i])); } break;
+
+    case LOP_SUB:
+      /* Unitary negation: (- 1) */
+      if (n == 1) { x = -x; }
+      for (int i = 1; i < n; i++) { x -= LNUM(cell[i]); }
+      break;
 
-    if (strcmp(op, "-") == 0)   { x->num -= y->num; }
-    if (strcmp(op, "+") == 0)   { x->num += y->num; }   // '+' is converted to int
-    if (strcmp(op, "*") == 0)   { x->num *= y->num; }
-    if (strcmp(op, "/") == 0)   {
-      /* Implement safe division */
-      if (y->num == 0) {
-        lval_del(x); lval_del(y);
-        x = lval_err("Division By Zero!");              // Error as value
-        break;
+    case LOP_DIV:
+    case LOP_MOD:
+      for (int i = 1; i < n; i++) {
+        /* Implement safe division */
+        if (LNUM(cell[i]) == 0) {
+          lval_del(a);
+          return lval_err("Division By Zero!");              // Error as value
+        }
+        /* The one quotient that does not fit, trapping like division by zero */
+        if (x == LONG_MIN && LNUM(cell[i]) == -1) {
+          lval_del(a);
+          return lval_err("Function '%s' overflows on %li and -1.", lop_names[op], x);
+        }
+        if (op == LOP_DIV) { x /= LNUM(cell[i]); } else { x %= LNUM(cell[i]); }
       }
-      x->num /= y->num;
-    }
-    if (strcmp(op, "%") == 0)   { x->num %= y->num; }
-    if (strcmp(op, "^") == 0)   { x->num = pow(x->num, y->num); }
-    if (strcmp(op, "min") == 0) { x->num = fmin(x->num, y->num); }
-    if (strcmp(op, "max") == 0) { x->num = fmax(x->num, y->num); }
-
-    lval_del(y);
+      break;
   }
 
   /* Deallocate the container */
   lval_del(a);
   /* Return the accumulator */
-  return x;
+  return lval_num(x);
 }
 
 lval* builtin_add(lenv* e, lval* a) {
-  return builtin_op(e, a, "+");
+  return builtin_op(e, a, LOP_ADD);
 }
 
 lval* builtin_sub(lenv* e, lval* a) {
-  return builtin_op(e, a, "-");
+  return builtin_op(e, a, LOP_SUB);
 }
 
 lval* builtin_mul(lenv* e, lval* a) {
-  return builtin_op(e, a, "*");
+  return builtin_op(e, a, LOP_MUL);
 }
 
 lval* builtin_div(lenv* e, lval* a) {
-  return builtin_op(e, a, "/");
+  return builtin_op(e, a, LOP_DIV);
 }
 
 lval* builtin_mod(lenv* e, lval* a) {
-  return builtin_op(e, a, "%");
+  return builtin_op(e, a, LOP_MOD);
 }
 
 lval* builtin_exp(lenv* e, lval* a) {
-  return builtin_op(e, a, "^");
+  return builtin_op(e, a, LOP_EXP);
 }
 
 lval* builtin_max(lenv* e, lval* a) {
-  return builtin_op(e, a, "max");
+  return builtin_op(e, a, LOP_MAX);
 }
 
 lval* builtin_min(lenv* e, lval* a) {
-  return builtin_op(e, a, "min");
+  return builtin_op(e, a, LOP_MIN);
 }
 
 /* Marco copy-and-paste into applied code, hence will short-circuit return the corresponding function */
@@ -776,10 +3810,10 @@ lval* builtin_min(lenv* e, lval* a) {
 
 /* Static type checker for function arguments */
 #define LASSERT_TYPE(func, args, index, expect) \
-  LASSERT(args, args->cell[index]->type == expect, \
+  LASSERT(args, LTYPE(args->cell[index]) == expect, \
     "Function '%s' passed incorrect type for argument %i. " \
     "Got %s, Expected %s.", \
-    func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+    func, index, ltype_name(LTYPE(args->cell[index])), ltype_name(expect))
 
 #define LASSERT_NUM(func, args, num) \
   LASSERT(args, args->count == num, \
@@ -799,10 +3833,12 @@ lval* builtin_head(lenv* e, lval* a) {
   LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
 
   /* Extract singleton/head */
-  lval* v = lval_take(a, 0);
+  lval* x = lval_take(a, 0);
 
-  /* Extract head by removing all elements after head */
-  while (v->count > 1) { lval_del(lval_pop(v, 1)); }
+  /* Share head in a new list rather than removing all elements after head */
+  lval* v = lval_qexpr();
+  if (x->count) { v = lval_add(v, lval_retain(x->cell[0])); }
+  lval_del(x);
 
   return v;
 }
@@ -811,9 +3847,10 @@ lval* builtin_tail(lenv* e, lval* a) {
   /* Guards required conditions and return error if contradicts */
   LASSERT_NUM("tail", a, 1);
   LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
+  LASSERT(a, a->cell[0]->count != 0, "Function 'tail' passed {}!");
 
   /* Extract singleton/head */
-  lval* v = lval_take(a, 0);
+  lval* v = lval_own(lval_take(a, 0));
 
   /* Chop off the head */
   lval_del(lval_pop(v, 0));
@@ -833,10 +3870,7 @@ lval* builtin_eval(lenv* e, lval* a) {
   LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
   /* Evaluates empty list */
 
-  lval* x = lval_take(a, 0);
-  /* Convert to list */
-  x->type = LVAL_SEXPR;
-  return lval_eval(e, x);
+  return lval_eval_qexpr(e, lval_take(a, 0));
 }
 
 lval* builtin_join(lenv* e, lval* a) {
@@ -847,11 +3881,11 @@ lval* builtin_join(lenv* e, lval* a) {
   }
 
   /* Get head for accumulator */
-  lval* x = lval_pop(a, 0);
+  lval* x = lval_retain(a->cell[0]);
 
-  while (a->count) {
+  for (int i = 1; i < a->count; i++) {
     /* Pass to 'lval_join' to also handle inner lists and delete each element */
-    x = lval_join(x, lval_pop(a, 0));
+    x = lval_join(x, lval_retain(a->cell[i]));
   }
 
   lval_del(a);
@@ -864,20 +3898,21 @@ lval* builtin_cons(lenv* e, lval* a) {
 
   lval* x = a->cell[0];
   lval* y = a->cell[1];
-  LASSERT(a, x->type == LVAL_NUM
-        || x->type == LVAL_SEXPR
-        || x->type == LVAL_QEXPR,
+  LASSERT(a, LTYPE(x) == LVAL_NUM
+        || LTYPE(x) == LVAL_SEXPR
+        || LTYPE(x) == LVAL_QEXPR,
         "Function 'cons' passed incorrect type in the first argument! "
-        "Got %s, Expected %s", x->type, "Number/S-Expression/Q-Expression");
+        "Got %s, Expected %s", ltype_name(LTYPE(x)), "Number/S-Expression/Q-Expression");
   LASSERT_TYPE("cons", a, 1, LVAL_QEXPR);
 
   /* Create a new list and append 'x' */
   lval* xs = lval_qexpr();
-  xs = lval_add(xs, x);
+  xs = lval_add(xs, lval_retain(x));
 
   /* Join new singleton list with list 'y' */
-  xs = lval_join(xs, y);
+  xs = lval_join(xs, lval_retain(y));
   
+  lval_del(a);
   return xs;
 }
 
@@ -887,9 +3922,10 @@ lval* builtin_len(lenv* e, lval* a) {
   /* Pure function */
   LASSERT_NUM("len", a, 1);
   LASSERT_TYPE("len", a, 0, LVAL_QEXPR);
-  lval* x = a->cell[0];
+  lval* x = lval_num(a->cell[0]->count);
 
-  return lval_num(x->count);
+  lval_del(a);
+  return x;
 }
 
 lval* builtin_init(lenv* e, lval* a) {
@@ -897,12 +3933,12 @@ lval* builtin_init(lenv* e, lval* a) {
   /* accepts single Qexpr list */
   LASSERT_NUM("init", a, 1);
   LASSERT_TYPE("init", a, 0, LVAL_QEXPR);
-  lval* x = a->cell[0];
+  lval* x = lval_own(lval_take(a, 0));
 
   /* Extract pointer to last element */
   /* Shift and reallocate cell */
   /* Delete returned the last-element pointer*/
-  lval_del(lval_pop(x, x->count - 1));
+  if (x->count) { lval_del(lval_pop(x, x->count - 1)); }
   return x;
 }
 
@@ -912,16 +3948,22 @@ lval* builtin_lambda(lenv* e, lval* a) {
   LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
 
   for (int i = 0; i < a->cell[0]->count; i++) {
-    LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+    LASSERT(a, (LTYPE(a->cell[0]->cell[i]) == LVAL_SYM),
       "Cannot define non-symbol. Got %s, Expected %s.",
-      ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+      ltype_name(LTYPE(a->cell[0]->cell[i])), ltype_name(LVAL_SYM));
   }
 
   lval* formals = lval_pop(a, 0);
   lval* body = lval_pop(a, 0);
   lval_del(a);
 
-  return lval_lambda(formals, body);
+  /* A body too deeply nested to compile could not run either */
+  lval* f = lval_lambda(formals, body);
+  if (!f->body->code) {
+    lval_del(f);
+    return lval_compile_err();
+  }
+  return f;
 }
 
 /* lval* builtin_fun(lenv* e, lval* a) {
@@ -946,6 +3988,63 @@ lval* builtin_put(lenv* e, lval* a) {
   return builtin_var(e, a, "=");
 }
 
+lval* builtin_pmap(lenv* e, lval* a) {
+  /* Apply function to each element of a list, on worker threads */
+  LASSERT_NUM("pmap", a, 2);
+  LASSERT_TYPE("pmap", a, 0, LVAL_FUN);
+  LASSERT_TYPE("pmap", a, 1, LVAL_QEXPR);
+  lval* x = lpar_run(LPAR_MAP, e, a->cell[0], NULL, a->cell[1]);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_pfilter(lenv* e, lval* a) {
+  /* Elements of a list for which function returns non-zero, on worker threads */
+  LASSERT_NUM("pfilter", a, 2);
+  LASSERT_TYPE("pfilter", a, 0, LVAL_FUN);
+  LASSERT_TYPE("pfilter", a, 1, LVAL_QEXPR);
+  lval* x = lpar_run(LPAR_FILTER, e, a->cell[0], NULL, a->cell[1]);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_spawn(lenv* e, lval* a) {
+  /* Future of applying a function to arguments, run by the scheduler */
+  /* in the global environment */
+  LASSERT(a, a->count > 0, "Function 'spawn' passed no arguments.");
+  LASSERT_TYPE("spawn", a, 0, LVAL_FUN);
+  lval* fut = lval_future(a);
+#ifndef _WIN32
+  if (lpar_workers() > 0) {
+    lpar_task t = { lval_retain(fut), NULL, 0, NULL, NULL };
+    lpar_push(&t);
+    return fut;
+  }
+#endif
+  lpar_resolve(fut);
+  return fut;
+}
+
+lval* builtin_await(lenv* e, lval* a) {
+  /* Value of a future, waiting for it if need be */
+  LASSERT_NUM("await", a, 1);
+  LASSERT_TYPE("await", a, 0, LVAL_FUT);
+  lval* x = lpar_await(a->cell[0]);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_preduce(lenv* e, lval* a) {
+  /* Combine an initial value and the elements of a list by an associative */
+  /* function, reducing chunks on worker threads */
+  LASSERT_NUM("preduce", a, 3);
+  LASSERT_TYPE("preduce", a, 0, LVAL_FUN);
+  LASSERT_TYPE("preduce", a, 2, LVAL_QEXPR);
+  lval* x = lpar_run(LPAR_REDUCE, e, a->cell[0], a->cell[1], a->cell[2]);
+  lval_del(a);
+  return x;
+}
+
 lval* builtin_var(lenv* e, lval* a, char* func) {
 
   /* Guard first cell of 'a' as List (Qexpr) */
@@ -956,10 +4055,10 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
 
   /* Guard the first cell 'syms' is arg List (Qexpr) of Symbols */
   for (int i = 0; i < syms->count; i++) {
-    LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
+    LASSERT(a, (LTYPE(syms->cell[i]) == LVAL_SYM),
       "Function '%s' cannot define non-symbol. "
       "Got %s, Expected %s.", func,
-      ltype_name(syms->cell[i]->type),
+      ltype_name(LTYPE(syms->cell[i])),
       ltype_name(LVAL_SYM));
   }
 
@@ -968,8 +4067,17 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
     "Function '%s' cannot define incorrect number of values to symbols. "
     "Got %i, Expected %i.", func, a->count - 1, syms->count);
 
+  /* Environments read by other calls of a parallel builtin cannot change */
+  /* meanwhile, except the global one, see lenv_publish */
+  lenv* target = strcmp(func, "def") == 0 ? lenv_outer(e) : e;
+  LASSERT(a, !lpar_shared(target),
+    "Function '%s' cannot define while a parallel builtin is running.", func);
+  LASSERT(a, !(lenv_sealed && target == lenv_global),
+    "Function '%s' cannot define in the sealed global environment.", func);
+
   /* All clear then assign copies (done by 'lenv_put') of values to symbols */
   for (int i = 0; i < syms->count; i++) {
+    lfold_bind(syms->cell[i]->sym, a->cell[i+1]);
     if (strcmp(func, "def") == 0) {
       /* i'th sym corresponds to (i+1)'th cell, 1st cell is 'sym' */
       lenv_def(e, syms->cell[i], a->cell[i+1]);
@@ -990,12 +4098,188 @@ lval* builtin_exit(lenv* e, lval* a) {
 }
 
 lval* builtin_env(lenv* e, lval* a) {
-  /* Prints out all defined values in 'e' */
-  for (int i = 0; i < e->count; i++) {
-    printf("%s \t", e->syms[i]);
-    lval_print(e->vals[i]);
-    putchar('\n');
+  /* Prints out all defined values in 'e', as they were when called */
+  lenv* x = lenv_snapshot(e);
+#ifndef _WIN32
+  flockfile(LVAL_OUT);
+#endif
+  for (int i = 0; i < x->count; i++) {
+    fprintf(LVAL_OUT, "%s \t", x->syms[i]);
+    lval_print(x->vals[i]);
+    putc('\n', LVAL_OUT);
+  }
+#ifndef _WIN32
+  funlockfile(LVAL_OUT);
+#endif
+  lenv_del(x);
+  lval_del(a);
+  return lval_sexpr();
+}
+
+lval* builtin_load(lenv* e, lval* a) {
+  /* Evaluate every line of a file in order */
+  LASSERT_NUM("load", a, 1);
+  LASSERT_TYPE("load", a, 0, LVAL_STR);
+
+  /* Files loading files nest like calls, so count against 'max-depth' */
+  if (lvm_full()) {
+    lval_del(a);
+    return lvm_depth_err();
+  }
+
+  lval* expr = lval_read_file(a->cell[0]->str);
+  lval_del(a);
+  if (LTYPE(expr) == LVAL_ERR) { return expr; }
+
+  lval_depth++;
+  lval* x = NULL;
+  while (expr->count) {
+    x = lval_eval(e, lval_pop(expr, 0));
+
+    /* Errors are reported and skipped, 'exit' stops early */
+    if (LTYPE(x) == LVAL_ERR) { lval_println(x); }
+    if (LTYPE(x) == LVAL_TERM) { break; }
+    lval_del(x);
+    x = NULL;
+  }
+  lval_depth--;
+
+  lval_del(expr);
+  return x ? x : lval_sexpr();
+}
+
+lval* builtin_save_image(lenv* e, lval* a) {
+  /* Write the global environment to a file, see '--image' */
+  LASSERT_NUM("save-image", a, 1);
+  LASSERT_TYPE("save-image", a, 0, LVAL_STR);
+
+  while (e->par) { e = e->par; }
+  lval* x = limage_save(e, a->cell[0]->str);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_serialize(lenv* e, lval* a) {
+  /* Write the encoding of a value to a file */
+  LASSERT_NUM("serialize", a, 2);
+  LASSERT_TYPE("serialize", a, 0, LVAL_STR);
+
+  long n;
+  char* data = lval_serialize(a->cell[1], &n);
+  if (!data) {
+    lval_del(a);
+    return lval_err("Could not serialize: nested deeper than %i", LSER_MAX_DEPTH);
+  }
+  lval* x = lfile_write(a->cell[0]->str, data, n);
+  free(data);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_deserialize(lenv* e, lval* a) {
+  /* Read back a value written by 'serialize' */
+  LASSERT_NUM("deserialize", a, 1);
+  LASSERT_TYPE("deserialize", a, 0, LVAL_STR);
+
+  long n;
+  char* src = lfile_map(a->cell[0]->str, &n);
+  if (!src) {
+    lval* err = lval_err("Could not read file '%s': %s",
+      a->cell[0]->str, strerror(errno));
+    lval_del(a);
+    return err;
+  }
+
+  lval* x = lval_deserialize(src, n);
+  lfile_unmap(src, n);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_print(lenv* e, lval* a) {
+  /* Print all arguments separated by spaces, as one line among threads */
+#ifndef _WIN32
+  flockfile(LVAL_OUT);
+#endif
+  for (int i = 0; i < a->count; i++) {
+    if (i) { putc(' ', LVAL_OUT); }
+    lval_print(a->cell[i]);
+  }
+  putc('\n', LVAL_OUT);
+#ifndef _WIN32
+  funlockfile(LVAL_OUT);
+#endif
+  lval_del(a);
+  return lval_sexpr();
+}
+
+lval* builtin_gc(lenv* e, lval* a) {
+  /* Force a collection, optionally setting the minimum threshold first */
+  /* Called as 'gc ()' like 'pool ()', or as 'gc 50000' */
+  int empty = a->count == 1 && LTYPE(a->cell[0]) == LVAL_SEXPR && a->cell[0]->count == 0;
+  LASSERT(a, a->count <= 1,
+    "Function 'gc' passed too many arguments. Got %i, Expected at most 1.", a->count);
+  if (a->count && !empty) {
+    LASSERT_TYPE("gc", a, 0, LVAL_NUM);
+    LASSERT(a, LNUM(a->cell[0]) >= 0,
+      "Function 'gc' passed invalid threshold %li.", LNUM(a->cell[0]));
   }
+  /* Tasks share the heap, so wait for them, unless in one */
+#ifndef _WIN32
+  LASSERT(a, !lpar_running,
+    "Function 'gc' cannot collect while running a task.");
+  lpar_help(&lpar_active);
+#endif
+  if (a->count && !empty) { lgc_minimum = LNUM(a->cell[0]); }
+  lval_del(a);
+
+  long freed = lgc_collect();
+  fprintf(LVAL_OUT, "collections %li \tfreed %li (total %li) \tlive %li \tthreshold %li\n",
+    lgc_collections, freed, lgc_freed, lgc_live, lgc_threshold);
+  return lval_sexpr();
+}
+
+lval* builtin_mem_stats(lenv* e, lval* a) {
+  /* Prints out live objects, peaks and allocation rates */
+  lmem_print(LVAL_OUT);
+  lval_del(a);
+  return lval_sexpr();
+}
+
+void lstats_print(FILE* f) {
+  /* Counters of the run so far as one line of 'key value' pairs */
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+  long rss = ru.ru_maxrss / 1024;     /* bytes */
+#else
+  long rss = ru.ru_maxrss;            /* kilobytes */
+#endif
+  fprintf(f, "lval_allocs %li lenv_allocs %li gc_collections %li gc_freed %li "
+    "peak_rss_kb %li\n",
+    lpool_allocs, lpool_env_allocs, lgc_collections, lgc_freed, rss);
+}
+
+lval* builtin_pool(lenv* e, lval* a) {
+  /* Prints out pool allocator counters */
+  fprintf(LVAL_OUT, "lval \tlive %li \tallocs %li \tslabs %li \t(%li bytes)\n",
+    lgc_live, lpool_allocs, lpool_nslabs, lpool_nslabs * (long)sizeof(lslab));
+  fprintf(LVAL_OUT, "lenv \tlive %li \tallocs %li \tslabs %li \t(%li bytes)\n",
+    lpool_env_live, lpool_env_allocs, lpool_env_nslabs,
+    lpool_env_nslabs * (long)sizeof(lenv_slab));
+  lval_del(a);
+  return lval_sexpr();
+}
+
+lval* builtin_max_depth(lenv* e, lval* a) {
+  /* Set the maximum depth of nested evaluation */
+  LASSERT_NUM("max-depth", a, 1);
+  LASSERT_TYPE("max-depth", a, 0, LVAL_NUM);
+  LASSERT(a, LNUM(a->cell[0]) > 0 && LNUM(a->cell[0]) <= INT_MAX,
+    "Function 'max-depth' passed invalid depth %li.", LNUM(a->cell[0]));
+
+  lvm_max_depth = LNUM(a->cell[0]);
+  lval_del(a);
   return lval_sexpr();
 }
 
@@ -1005,84 +4289,64 @@ lval* builtin_if(lenv* e, lval* a) {
   LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
   LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
 
-  /* Mark yes and no branch expressions as executable SExpr */
-  a->cell[1]->type = LVAL_SEXPR;
-  a->cell[2]->type = LVAL_SEXPR;
-
-  /* Only execute relevant branch */
-  lval* x;
+  /* Only execute relevant branch, as executable SExpr */
   /* Condition shall be SExpr that quickly evaluates to LVAL_NUM  , cannot be QExpr */
-  if (a->cell[0]->num) {
-    x = lval_eval(e, lval_pop(a, 1));
-  } else {
-    x = lval_eval(e, lval_pop(a, 2));
-  }
-
-  lval_del(a);
-  return x;
+  lval* x = lval_take(a, LNUM(a->cell[0]) ? 1 : 2);
+  return lval_eval_qexpr(e, x);
 }
 
 lval* builtin_gt(lenv* e, lval* a) {
-  return builtin_ord(e, a, ">");
+  return builtin_ord(e, a, LOP_GT);
 }
 
 lval* builtin_lt(lenv* e, lval* a) {
-  return builtin_ord(e, a, "<");
+  return builtin_ord(e, a, LOP_LT);
 }
 
 lval* builtin_ge(lenv* e, lval* a) {
-  return builtin_ord(e, a, ">=");
+  return builtin_ord(e, a, LOP_GE);
 }
 
 lval* builtin_le(lenv* e, lval* a) {
-  return builtin_ord(e, a, "<=");
+  return builtin_ord(e, a, LOP_LE);
 }
 
 
-lval* builtin_ord(lenv* e, lval* a, char* op) {
+lval* builtin_ord(lenv* e, lval* a, int op) {
   /* Representing 0 == False, otherwise True */
   /* Supports Number ordering for now */
 
-  LASSERT_NUM(op, a, 2);
-  LASSERT_TYPE(op, a, 0, LVAL_NUM);
-  LASSERT_TYPE(op, a, 1, LVAL_NUM);
-
-  int r;
-  if (strcmp(op, ">") == 0) {
-    r = (a->cell[0]->num > a->cell[1]->num);
-  }
-  if (strcmp(op, "<") == 0) {
-    r = (a->cell[0]->num < a->cell[1]->num);
-  }
-  if (strcmp(op, ">=") == 0) {
-    r = (a->cell[0]->num >= a->cell[1]->num);
-  }
-  if (strcmp(op, "<=") == 0) {
-    r = (a->cell[0]->num <= a->cell[1]->num);
+  LASSERT_NUM(lop_names[op], a, 2);
+  LASSERT_TYPE(lop_names[op], a, 0, LVAL_NUM);
+  LASSERT_TYPE(lop_names[op], a, 1, LVAL_NUM);
+
+  long x = LNUM(a->cell[0]);
+  long y = LNUM(a->cell[1]);
+  int r = 0;
+  switch (op) {
+    case LOP_GT: r = (x > y);   break;
+    case LOP_LT: r = (x < y);   break;
+    case LOP_GE: r = (x >= y);  break;
+    case LOP_LE: r = (x <= y);  break;
   }
   lval_del(a);
   return lval_num(r);
 }
 
-lval* builtin_cmp(lenv* e, lval* a, char* op) {
-  LASSERT_NUM(op, a, 2);
-  int r;
-  if (strcmp(op, "==") == 0) {
-    r = lval_eq(a->cell[0], a->cell[1]);
-  }
-  if (strcmp(op, "!=") == 0) {
-    r = !lval_eq(a->cell[0], a->cell[1]);
-  }
+lval* builtin_cmp(lenv* e, lval* a, int op) {
+  LASSERT_NUM(lop_names[op], a, 2);
+  int r = lval_eq(a->cell[0], a->cell[1]);
+  if (op == LOP_NE) { r = !r; }
   lval_del(a);
   return lval_num(r);
 }
 
 lval* builtin_eq(lenv* e, lval* a) {
-  return builtin_cmp(e, a, "==");
+  return builtin_cmp(e, a, LOP_EQ);
 }
 
 lval* builtin_ne(lenv* e, lval* a) {
-  return builtin_cmp(e, a, "!=");
+  return builtin_cmp(e, a, LOP_NE);
 }
 
 /**
@@ -1092,6 +4356,35 @@ lval* builtin_ne(lenv* e, lval* a) {
 
 int main(int argc, char** argv) {
 
+  /* Parse through the mpc grammar rather than the reader, for debugging */
+  /* Other arguments are files to run instead of the prompt */
+  /* '--image' starts from the bindings saved by 'save-image' */
+  /* '--profile' samples Lisp calls, writing folded stacks to a file on exit */
+  /* '--stats' prints counters of the run on exit, see bench/bench.sh */
+  /* '--threads' sets the threads of the scheduler, 1 running tasks sequentially */
+  /* '--serve' evaluates lines of clients of a Unix socket instead of the */
+  /* prompt, the files being loaded first as libraries */
+  /* '--batch' evaluates every line of standard input instead of the prompt, */
+  /* writing all values at once when done */
+  int use_mpc = 0;
+  int batch = 0;
+  int stats = 0;
+  char* image = NULL;
+  char* profile = NULL;
+  char* serve = NULL;
+  int nfiles = 0;
+  char** files = malloc(sizeof(char*) * argc);
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--mpc") == 0) { use_mpc = 1; }
+    else if (strcmp(argv[i], "--stats") == 0) { stats = 1; }
+    else if (strcmp(argv[i], "--batch") == 0) { batch = 1; }
+    else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) { image = argv[++i]; }
+    else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) { profile = argv[++i]; }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) { lpar_threads = atoi(argv[++i]); }
+    else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) { serve = argv[++i]; }
+    else { files[nfiles++] = argv[i]; }
+  }
+
   /* Define some parsers */
   mpc_parser_t* Number = mpc_new("number");
   mpc_parser_t* Symbol = mpc_new("symbol");
@@ -1101,16 +4394,18 @@ int main(int argc, char** argv) {
   mpc_parser_t* Lispy = mpc_new("lispy");
   
   /* Define the language */
-  mpca_lang(MPCA_LANG_DEFAULT,
-    "                                                                   \
-     number   : /-?[0-9]+/ ;                                            \
-     symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&^]+/ ;                      \
-     sexpr    : '(' <expr>* ')' ;                                       \
-     qexpr    : '{' <expr>* '}' ;                                       \
-     expr     : <number> | <symbol> | <sexpr> | <qexpr>;                \
-     lispy    : /^/ <expr>* /$/ ;                                       \
-    ",
-    Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  if (use_mpc) {
+    mpca_lang(MPCA_LANG_DEFAULT,
+      "                                                                   \
+       number   : /-?[0-9]+/ ;                                            \
+       symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&^%]+/ ;                     \
+       sexpr    : '(' <expr>* ')' ;                                       \
+       qexpr    : '{' <expr>* '}' ;                                       \
+       expr     : <number> | <symbol> | <sexpr> | <qexpr>;                \
+       lispy    : /^/ <expr>* /$/ ;                                       \
+      ",
+      Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  }
     // TODO
     // Double: /-?0\.[0-9]+/ | /-?[1-9]+\.[0-9]+/
     // unitary negate
@@ -1118,15 +4413,89 @@ int main(int argc, char** argv) {
     // number clisp> 2
     // union vs struct
 
-  /* Print Lisp information */
-  puts("Lispy version 0.0.0.0.1");
-  puts("Press Ctrl+c to Exit\n");
-
   lenv* e = lenv_new();
+  lenv_share(e);
   lenv_add_builtins(e);
+
+  if (profile && !lprof_start(LPROF_INTERVAL)) {
+    fprintf(stderr, "Could not start profiler: %s\n", strerror(errno));
+    profile = NULL;
+  }
+
+  /* An image that cannot be loaded fails the run */
+  int status = 0;
+  if (image) {
+    lval* x = limage_load(e, image);
+    if (LTYPE(x) == LVAL_ERR) {
+      lval_println(x);
+      status = 1;
+      nfiles = 0;
+    }
+    lval_del(x);
+  }
+
+  /* Batch mode: load each file in order, without the prompt */
+  for (int i = 0; i < nfiles; i++) {
+    lval* x = builtin_load(e, lval_add(lval_sexpr(), lval_str(files[i])));
+
+    /* A file that cannot be read fails the run */
+    if (LTYPE(x) == LVAL_ERR) {
+      lval_println(x);
+      status = 1;
+    }
+    int stop = LTYPE(x) == LVAL_TERM || status;
+    lval_del(x);
+    if (stop) { serve = NULL; break; }
+  }
+
+  /* Serve only once everything loaded */
+  int is_running = !nfiles && !status && !serve && !batch;
+  if (serve && !status) {
+    status = lsrv_run(e, serve);
+  }
+
+  /* Read all lines together, printing into one buffer written at the end */
+  if (batch && !status) {
+    long n = 0;
+    long capacity = 1 << 16;
+    char* src = malloc(capacity);
+    size_t r;
+    while ((r = fread(src + n, 1, capacity - n, stdin)) > 0) {
+      n += r;
+      if (n == capacity) {
+        capacity *= 2;
+        src = realloc(src, capacity);
+      }
+    }
+    lval* exprs = lval_read_buf("<stdin>", src, n, 1);
+    free(src);
+
+    /* Input that cannot be read fails the run, evaluating none of it */
+    if (LTYPE(exprs) == LVAL_ERR) {
+      lval_println(exprs);
+      lval_del(exprs);
+      status = 1;
+    } else {
+#ifndef _WIN32
+      lout_stream out;
+      lout_open(&out);
+#endif
+      lval_eval_batch(e, exprs);
+#ifndef _WIN32
+      lout_close(&out);
+      fwrite(out.data, 1, out.count, stdout);
+      free(out.data);
+#endif
+    }
+  }
+
+  /* Print Lisp information */
+  if (is_running) {
+    puts("Lispy version 0.0.0.0.1");
+    puts("Press Ctrl+c to Exit\n");
+  }
   
   /* In a loop */
-  int is_running = 1;
   while (is_running) {
 
     /* Output our prompt */
@@ -1136,27 +4505,39 @@ int main(int argc, char** argv) {
     char* input = readline("clisp> ");
     /* Done in one go */
 
+    /* End of input */
+    if (!input) { break; }
+
     /* Add input to history */
     add_history(input);
 
-    mpc_result_t r;
-    if (mpc_parse("<stdin>", input, Lispy, &r)) {
-      /* On Success -> Evaluate the AST */
-      lval* x = lval_eval(e, lval_read(r.output));         // Composition
+    lval* x = NULL;
+    if (!use_mpc) {
+      /* Read straight into lvals, a parse error evaluates to itself */
+      x = lval_eval(e, lval_read_str("<stdin>", input));
+    } else {
+      mpc_result_t r;
+      if (mpc_parse("<stdin>", input, Lispy, &r)) {
+        /* On Success -> Evaluate the AST */
+        x = lval_eval(e, lval_read(r.output));         // Composition
+        // mpc_ast_print(r.output);
+        mpc_ast_delete(r.output);
+      } else {
+        /* On Error -> Print the error */
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+      }
+    }
+
+    if (x) {
       lval_println(x);
 
-      if (x->type == LVAL_TERM) {
+      if (LTYPE(x) == LVAL_TERM) {
         /* Signals termination by user */
         is_running = 0;
       }
 
       lval_del(x);
-      // mpc_ast_print(r.output);
-      mpc_ast_delete(r.output);
-    } else {
-      /* On Error -> Print the error */
-      mpc_err_print(r.error);
-      mpc_err_delete(r.error);
     }
 
     /* Echo back to user */
@@ -1165,11 +4546,39 @@ int main(int argc, char** argv) {
     /* Free retrieved input at dynamic memory */
     free(input);
   }
+
+  /* Spawned tasks still running share the environment */
+#ifndef _WIN32
+  lpar_help(&lpar_active);
+#endif
+  if (stats) {
+    fflush(stdout);
+    lstats_print(stderr);
+  }
+
+  /* Report before the environment, and names of functions, are gone */
+  if (profile) {
+    lprof_stop();
+    FILE* folded = fopen(profile, "w");
+    if (folded) {
+      lprof_report(folded, stderr);
+      fclose(folded);
+    } else {
+      fprintf(stderr, "Could not write profile '%s': %s\n", profile, strerror(errno));
+    }
+  }
+
   lenv_del(e);
+  free(files);
+
+#ifdef LMEM_STATS
+  /* Everything has been released, so whatever is left leaked */
+  lmem_leaks(stderr);
+#endif
 
   /* Undefine and delete allocated parsers */
   /* aka clean up on exit */
   mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
 
-  return 0;
+  return status;
 }
\ No newline at end of file
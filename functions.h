@@ -15,53 +15,391 @@
 /* Forward Declarations */
 struct lval;
 struct lenv;
+struct lchunk;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lchunk lchunk;
 
 /* Lispy Value */
 /* Enum of type constants */
-enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, 
-       LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_TERM };
+enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_STR,
+       LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUT, LVAL_TERM };
 
 /* Error String Buffer Maximum Size */
 const int ERROR_BUFFER_SIZE = 512;
 
+/* Enum of call sites whose allocations are counted with -DLMEM_STATS, */
+/* see 'mem-stats' */
+enum { LMEM_LVAL, LMEM_LENV, LMEM_CELLS, LMEM_COPY, LMEM_ENV_COPY,
+       LMEM_ERR, LMEM_STR, LMEM_BIND, LMEM_SYM, LMEM_CODE, LMEM_NSITES };
+
+#ifdef LMEM_STATS
+#define LMEM_COUNT(site, bytes) lmem_count(site, bytes)
+#else
+#define LMEM_COUNT(site, bytes)
+#endif
+
+/* Garbage Collector tuning: first threshold of live lvals, and */
+/* growth factor of the threshold over the survivors of a collection */
+#ifndef LGC_MINIMUM
+#define LGC_MINIMUM 100000
+#endif
+#ifndef LGC_GROWTH
+#define LGC_GROWTH 2
+#endif
+#define LGC_MARKED -1
+
+/* Collect cycles once the heap outgrows the threshold, see lgc_safepoint */
+#define LGC_SAFEPOINT() \
+  if (lgc_live > lgc_threshold) { lgc_safepoint(); }
+
+/* Whether tasks are queued or running, so other threads may share the heap */
+#define LPAR_ACTIVE() __atomic_load_n(&lpar_active, __ATOMIC_ACQUIRE)
+
+/* Update a count shared by threads, atomically while tasks run */
+#define LPAR_ADD(x, n) \
+  (LPAR_ACTIVE() ? __atomic_add_fetch(&(x), (n), __ATOMIC_ACQ_REL) : ((x) += (n)))
+
+/* Enum of arithmetic and comparison operators, dispatched by builtin_op, */
+/* builtin_ord and builtin_cmp */
+enum { LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_MOD, LOP_EXP, LOP_MIN, LOP_MAX,
+       LOP_GT, LOP_LT, LOP_GE, LOP_LE, LOP_EQ, LOP_NE };
+
 /* Define lbuiltin new function type */
 typedef lval* (*lbuiltin)(lenv*, lval*);
 
 /* Define Lispy Value struct */
+/* A tagged union: 'type' selects which member of the payload is valid */
 struct lval {
   /* Type is Enum */
   int type;
+  int ref;          /* Reference count, shared values are copied before mutation */
+  int gc_ref;       /* Scratch count of references from outside the heap */
+
+  union {
+    /* Basic */
+    long num;         /* Numerical value (if any), only when too large to be immediate */
+    char* err;        /* Error and Symbol are Strings */
+    char* sym;        /* Symbol is redefined from functions to variable bindings */
+                      /* interned by lsym_intern, so equal symbols share a pointer */
+    char* str;        /* String literal, owned */
+
+    /* Function */
+    struct {
+      lbuiltin builtin; /* Function as first class citizen, type function pointer */
+                        /* if builtin != null then builtin_fun else user_def_fun */
+      lenv* env;        /* Environment of bound arguments exclusively for this function */
+      lval* formals;    /* Q-Expr of argument list */
+      lval* body;       /* Q-Expr of function body */
+      lval* cap;        /* Function whose bound arguments 'env' extends (if any) */
+    };
+
+    /* Expression */
+    struct {
+      int count;        /* count and cell as pointer to recursively-defined lval pointers, interpreted as lists 
+                            the use of pointers is to allow variable length expressions */
+      int capacity;     /* Cells allocated, grown geometrically by lval_reserve */
+      lval** cell;      /* cell resembles cons cell */
+      lchunk* code;     /* Compiled bytecode of this expression (if any), see lval_compile */
+      int offset;       /* Cells popped off the head, so cell starts this far into its memory */
+    };
+
+    /* Future */
+    struct {
+      lval* call;       /* S-Expression of function and arguments, until run */
+      lval* value;      /* Result of the call, once done */
+      int pending;      /* Nonzero until 'value' is set, read atomically */
+    };
+
+    /* Heap */
+    lval* next_free;  /* Next free slot in the pool, while ref is 0 */
+  };
+};
 
-  /* Basic */
-  long num;         /* Numerical value (if any) */
-  char* err;        /* Error and Symbol are Strings */
-  char* sym;        /* Symbol is redefined from functions to variable bindings */
-
-  /* Function */
-  lbuiltin builtin; /* Function as first class citizen, type function pointer */
-                    /* if builtin != null then builtin_fun else user_def_fun */
-  lenv* env;        /* Environment of bound arguments exclusively for this function */
-  lval* formals;    /* Q-Expr of argument list */
-  lval* body;       /* Q-Expr of function body */
-
-  /* Expression */
-  int count;        /* count and cell as pointer to recursively-defined lval pointers, interpreted as lists 
-                        the use of pointers is to allow variable length expressions */
-  lval** cell;      /* cell resembles cons cell */
+/* Immediate Numbers */
+/* Numbers that fit are encoded in the lval pointer itself with the low */
+/* bit set, so are never allocated. Read type and number through */
+/* LTYPE and LNUM, which see through both encodings */
+#define LFIX_P(v)   (((uintptr_t)(v)) & 1)
+#define LFIX(x)     ((lval*)((((uintptr_t)(x)) << 1) | 1))
+#define LFIX_MIN    (LONG_MIN >> 1)
+#define LFIX_MAX    (LONG_MAX >> 1)
+#define LTYPE(v)    (LFIX_P(v) ? LVAL_NUM : (v)->type)
+#define LNUM(v)     (LFIX_P(v) ? (long)(((intptr_t)(v)) >> 1) : (v)->num)
+
+/* Define a stream printers write to in place of stdout, such as the reply */
+/* to a client of the server, with the tasks queued while it was current */
+typedef struct {
+  FILE* f;
+  char* data;       /* Everything written, once closed */
+  size_t count;
+  int tasks;        /* Tasks yet to finish printing here, atomically */
+} lout_stream;
+
+/* Stream printers write to: stdout, or that of the work in this thread */
+#define LVAL_OUT (lval_out ? lval_out->f : stdout)
+
+/* Bytecode instructions, each followed by a single integer operand except OP_RET */
+enum { OP_CONST,    /* push copy of consts[k] */
+       OP_LOAD,     /* push value of symbol consts[k] looked up in env */
+       OP_ARG,      /* push value at slot k of env and skip the OP_LOAD that */
+                    /* follows, if its symbol is bound there */
+       OP_FOLD,     /* push consts[k] if no pure builtin it calls was rebound */
+                    /* was folded, else skip the OP_JUMP that follows */
+       OP_JUMP,     /* skip the next k instructions */
+       OP_CALL,     /* apply top n values as an evaluated S-Expression */
+       OP_RET };    /* return top of stack */
+
+/* Define compiled Lispy code, shared between copies of the same expression */
+struct lchunk {
+  int ref;          /* Number of lvals holding this chunk */
+  int count;        /* Length of code */
+  int* ops;         /* Instructions and operands */
+  int nconsts;      /* count and consts as constant pool of literals and symbols */
+  lval** consts;
+  char** names;     /* Symbol in head position of each OP_CALL (if any), by pc / 2 */
+  lval* formals;    /* Formals addressed by slot with OP_ARG (if any) */
+  unsigned folds;   /* Bit of each pure builtin its folded calls depend on */
 };
 
+/* Default maximum depth of nested evaluation, see 'max-depth' */
+#ifndef LVM_MAX_DEPTH
+#define LVM_MAX_DEPTH 10000
+#endif
+
+/* Deepest nesting of lists compiled, see lval_compile_node */
+#ifndef LVM_MAX_NESTING
+#define LVM_MAX_NESTING 10000
+#endif
+
+/* Define call frame of the virtual machine */
+typedef struct {
+  lchunk* code;     /* Code being run, held by the frame */
+  int pc;           /* Offset of next instruction */
+  lenv* env;        /* Environment of evaluation */
+  lval* fun;        /* Bound function owning 'env' (if any), released on return */
+  char* name;       /* Symbol the running function was called by, for the profiler */
+} lframe;
+
+/* Microseconds of CPU time between samples of the profiler, see '--profile' */
+#ifndef LPROF_INTERVAL
+#define LPROF_INTERVAL 1000
+#endif
+
+/* Define strings counted by the profiler, such as folded stacks, by order */
+/* of first being counted, with an open-addressing index over them */
+typedef struct {
+  int count;
+  char** keys;      /* Own copies */
+  long* counts;
+  int capacity;     /* a power of two */
+  int* index;       /* Each slot is 0 if empty, else 1 + position in keys */
+} lprof_table;
+
+/* Sample the stack of Lisp calls once the profiler's timer has fired */
+#define LPROF_SAFEPOINT() \
+  if (lprof_pending) { lprof_sample(); }
+
+/* Number of lvals or lenvs carved out of each pool slab */
+#ifndef LPOOL_SLAB
+#define LPOOL_SLAB 1024
+#endif
+
 /* Define Lipsy Environment to record name bindings */
 struct lenv {
   lenv* par;
-  int count;
-  char** syms;
+  lenv* up;         /* Frame of bound arguments captured from a function (if any), */
+                    /* searched before 'par' and never changed once shared */
+  lenv* tab;        /* Bindings of the global environment, replaced as a whole */
+                    /* while other threads read them, see lenv_share (if any) */
+  int count;        /* count, syms and vals as bindings in insertion order */
+  char** syms;      /* Interned symbol names */
   lval** vals;
+  int capacity;     /* Open-addressing hash index over syms, a power of two in size */
+  int* index;       /* Each slot is 0 if empty, else 1 + position in syms and vals */
 };
 
+/* Threads that may read the global environment at once, see lrcu_enter */
+#ifndef LRCU_SLOTS
+#define LRCU_SLOTS 1024
+#endif
+
+/* Define the epoch a thread is reading in, alone on its cache line */
+typedef struct {
+  unsigned long epoch;
+  char pad[64 - sizeof(unsigned long)];
+} lrcu_slot;
+
+/* Define bindings replaced in the global environment, freed after 'epoch' */
+typedef struct lrcu_node lrcu_node;
+struct lrcu_node {
+  lrcu_node* next;
+  lenv* tab;
+  unsigned long epoch;
+};
+
+/* Define pool slabs of fixed-size lval and lenv headers */
+typedef struct lslab lslab;
+struct lslab {
+  lslab* next;
+  lval vals[LPOOL_SLAB];
+};
+
+typedef struct lenv_slab lenv_slab;
+struct lenv_slab {
+  lenv_slab* next;
+  lenv envs[LPOOL_SLAB];
+};
+
+/* Threads of the scheduler, see 'spawn' and 'pmap', counting the calling */
+/* thread: 0 for one per online processor. Lists shorter than two chunks */
+/* of LPAR_CHUNK elements run in the calling thread */
+#ifndef LPAR_THREADS
+#define LPAR_THREADS 0
+#endif
+#ifndef LPAR_MAX_THREADS
+#define LPAR_MAX_THREADS 256
+#endif
+#ifndef LPAR_CHUNK
+#define LPAR_CHUNK 64
+#endif
+
+/* Enum of parallel jobs */
+enum { LPAR_MAP, LPAR_FILTER, LPAR_REDUCE };
+
+/* Define a parallel job, applying 'f' over the cells of 'list' in chunks */
+typedef struct {
+  int kind;
+  lenv* env;        /* Environment of the calls, read by every thread */
+  lval* f;
+  lval* init;       /* Initial value when reducing */
+  lval* list;
+  lval** out;       /* Result per element, or per chunk when reducing */
+  int chunk;        /* Elements per chunk */
+  int nchunks;
+  int pending;      /* Chunks not yet run, atomically */
+  int failed;       /* First element (or chunk) failing, else INT_MAX */
+} lpar_job;
+
+/* Longest line a client of the server may send, see lsrv_take */
+#ifndef LSRV_MAX_LINE
+#define LSRV_MAX_LINE (1 << 20)
+#endif
+
+/* Define a client of the server, with bytes read but not yet evaluated */
+/* and an environment of its own below the global one */
+typedef struct {
+  int fd;
+  lenv* env;
+  char* in;
+  long count;
+  long capacity;
+  char* lines;      /* Complete lines taken by a task (if any) */
+  int busy;         /* Whether a task has taken lines, atomically */
+  int closing;      /* The client sent everything it will */
+  int term;         /* A line evaluated to exit */
+} lsrv_session;
+
+/* Define a task of the scheduler: evaluating the line of 'session' if set, */
+/* else resolving future 'fut' if set, else running chunk 'chunk' of 'job' */
+typedef struct {
+  lval* fut;
+  lpar_job* job;
+  int chunk;
+  lsrv_session* session;
+  lout_stream* out;   /* Stream of the thread queuing it (if any), see lpar_push */
+} lpar_task;
+
+#ifndef _WIN32
+/* Define a deque of tasks per thread: its owner pushes and pops at the */
+/* bottom, other threads steal from the top */
+typedef struct {
+  pthread_mutex_t lock;
+  lpar_task* tasks;   /* Ring of tasks, a power of two in size */
+  long capacity;
+  long top;           /* Position of the oldest task */
+  long bottom;        /* Position after the newest task */
+} lpar_deque;
+#endif
+
+/* Binary encodings of lvals, see 'serialize' and 'save-image' */
+#define LSER_VERSION 2
+#define LSER_MAGIC_SIZE 4
+#define LSER_MAGIC "LVAL"
+#define LIMAGE_MAGIC "LIMG"
+#ifndef LSER_MAX_DEPTH
+#define LSER_MAX_DEPTH 10000
+#endif
+
+/* Enum of tags, each followed by its payload: numbers as zigzag varints, */
+/* strings as a varint number of bytes then the bytes, symbols as a varint */
+/* order of first use then the name if this is it, lists as a varint count */
+/* then each element, and values already written as a varint order of writing */
+enum { LSER_NUM, LSER_ERR, LSER_SYM, LSER_STR, LSER_BUILTIN,
+       LSER_LAMBDA, LSER_SEXPR, LSER_QEXPR, LSER_TERM, LSER_REF };
+
+/* Pointers by order of first being seen, as open-addressing table */
+typedef struct {
+  int count;
+  int capacity;     /* a power of two */
+  void** keys;
+  int* ids;
+} lser_table;
+
+/* Encoding being written, with values and symbol names written so far */
+typedef struct {
+  char* data;
+  long count;
+  long capacity;
+  lser_table vals;
+  lser_table syms;
+  int depth;        /* Values being written, each inside the last */
+  int too_deep;     /* Whether they reached LSER_MAX_DEPTH, so reading would fail */
+} lser_out;
+
+/* Encoding being read, with values and symbol names read so far */
+typedef struct {
+  char* p;
+  char* end;
+  int count;
+  int capacity;
+  lval** seen;
+  char* done;
+  int nsyms;
+  char** syms;
+  int depth;        /* Values being read, each inside the last */
+  int too_deep;     /* Whether they ever reached LSER_MAX_DEPTH */
+} lser_in;
+
 
 
+/**
+ * Pool Allocator and Garbage Collector
+ * 
+ */
+
+void lpar_lock(void);
+void lpar_unlock(void);
+int lrcu_enter(lenv* e);
+void lrcu_leave(int reading);
+void lrcu_retire(lenv* t);
+void lrcu_reclaim(int all);
+
+void lpool_refill(void);
+lval* lval_alloc(void);
+void lval_free(lval* v);
+void lpool_env_refill(void);
+lenv* lenv_alloc(void);
+void lenv_free(lenv* e);
+void lpool_return(void);
+long lgc_collect(void);
+void lgc_safepoint(void);
+
+void lmem_count(int site, long bytes);
+void lmem_live(long* counts);
+void lmem_print(FILE* f);
+void lmem_leaks(FILE* f);
+
 /**
  * lval Constructors and Destructor 
  * 
@@ -70,14 +408,26 @@ struct lenv {
 lval* lval_num(long x);
 lval* lval_err(char* fmt, ...);
 lval* lval_sym(char* s);
+lval* lval_str(char* s);
 lval* lval_sexpr(void);
 lval* lval_qexpr(void);
 lval* lval_builtin(lbuiltin func);
 lval* lval_lambda(lval* formals, lval* body);
 lval* lval_term(void);
+lval* lval_future(lval* call);
 
 char* ltype_name(int t);
 void lval_del(lval* v);
+void lval_destroy(lval* v);
+
+/**
+ * Symbol Interning
+ * 
+ */
+
+char* lsym_intern(char* s);
+char* lsym_intern_n(char* s, int n);
+char* lsym_insert(char* s, int n);
 
 /**
  * lenv Constructors and Destructor and Manipulators
@@ -86,10 +436,18 @@ void lval_del(lval* v);
 lenv* lenv_new(void);
 void lenv_del(lenv* e);
 
+lval* lenv_find(lenv* e, char* sym);
 lval* lenv_get(lenv* e, lval* k);
 void lenv_put(lenv* e, lval* k, lval* v);
+void lenv_set(lenv* e, lval* k, lval* v);
+void lenv_share(lenv* e);
+lenv* lenv_table(lenv* e);
+void lenv_publish(lenv* e, lval* k, lval* v);
+lenv* lenv_snapshot(lenv* e);
+lenv* lenv_outer(lenv* e);
 void lenv_def(lenv* e, lval* k, lval* v);
 lenv* lenv_copy(lenv* e);
+int lenv_has(lenv* e, char* sym);
 
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func);
 void lenv_add_builtins(lenv* e);
@@ -99,6 +457,15 @@ void lenv_add_builtins(lenv* e);
  * 
  */
 
+int lread_symbol_char(char c);
+lval* lval_read_str(char* name, char* src);
+lval* lval_read_buf(char* name, char* src, long n, int lines);
+lval* lval_read_err(char* name, char* src, char* end, char* p, char* msg);
+lval* lval_read_file(char* path);
+char* lfile_map(char* path, long* n);
+void lfile_unmap(char* src, long n);
+lval* lfile_write(char* path, char* data, long n);
+
 lval* lval_read_num(mpc_ast_t* t);
 lval* lval_read(mpc_ast_t* t) ;
 
@@ -110,7 +477,10 @@ lval* lval_read(mpc_ast_t* t) ;
 
 void lval_print(lval* v);
 void lval_expr_print(lval* v, char open, char close);
+void lval_str_print(lval* v);
 void lval_println(lval* v);
+void lout_open(lout_stream* o);
+void lout_close(lout_stream* o);
 
 
 /**
@@ -118,18 +488,133 @@ void lval_println(lval* v);
  * 
  */
 
+void lval_reserve(lval* v, int n);
 lval* lval_add(lval* v, lval* x);
 
 lval* lval_eval_sexpr(lenv* e, lval* v);
 lval* lval_eval(lenv* e, lval* v);
+lval* lval_eval_qexpr(lenv* e, lval* x);
+int lval_eval_batch(lenv* e, lval* exprs);
 lval* lval_pop(lval* v, int i);
 lval* lval_take(lval* v, int i);
 lval* lval_join(lval* x, lval* y);
 
 lval* lval_copy(lval* v);
+char* lval_serialize(lval* v, long* n);
+lval* lval_deserialize(char* src, long n);
+lval* lval_retain(lval* v);
+lval* lval_own(lval* v);
 int lval_eq(lval* x, lval* y);
 
-lval* lval_call(lenv* e, lval* f, lval* a);
+lval* lval_call(lenv* e, lval* f, lval* a, char* name);
+lval* lval_bind(lenv* e, lval* f, lval* a);
+lval* lval_apply(lenv* e, lval* v, char* name);
+
+/**
+ * Compiler / Virtual Machine
+ * 
+ */
+
+lval* lval_compile(lval* v);
+lval* lval_compile_in(lval* v, lval* formals);
+lval* lval_compile_err(void);
+void lfold_register(char* sym, lbuiltin func);
+int lfold_index(char* sym);
+void lfold_bind(char* sym, lval* v);
+lval* lval_fold(lval* v, unsigned* folds);
+int lchunk_emit_fold(lchunk* c, lval* v);
+void lchunk_patch_fold(lchunk* c, int jump);
+void lval_uncompile(lval* v);
+void lchunk_del(lchunk* c);
+lval* lvm_exec(lenv* e, lchunk* c, char* name);
+int lvm_full(void);
+lval* lvm_depth_err(void);
+
+/**
+ * Profiler
+ * 
+ */
+
+int lprof_start(int interval);
+void lprof_stop(void);
+int lprof_find(lprof_table* t, char* s, int n);
+void lprof_free(lprof_table* t);
+void lprof_sample(void);
+void lprof_report(FILE* folded, FILE* summary);
+
+/**
+ * Scheduler
+ * 
+ */
+
+int lpar_shared(lenv* e);
+int lpar_failed(lval* v);
+void lpar_fail(lpar_job* job, int i);
+lval* lpar_call(lpar_job* job, lval* x, lval* y);
+void lpar_chunk(lpar_job* job, int k);
+void lpar_push(lpar_task* t);
+int lpar_take(lpar_task* t);
+void lpar_wake(void);
+void lpar_wait(int* pending);
+void lpar_finish(int* pending);
+void lpar_exec(lpar_task* t);
+void lpar_help(int* pending);
+void* lpar_worker(void* arg);
+int lpar_workers(void);
+void lpar_resolve(lval* fut);
+lval* lpar_await(lval* fut);
+lval* lpar_collect(lpar_job* job);
+lval* lpar_run(int kind, lenv* e, lval* f, lval* init, lval* list);
+
+/**
+ * Server
+ * 
+ */
+
+void lsrv_stop(int sig);
+lsrv_session* lsrv_open(int fd);
+void lsrv_close(lsrv_session* s);
+int lsrv_take(lsrv_session* s);
+void lsrv_reply(int fd, char* data, long n);
+void lsrv_eval(lsrv_session* s);
+int lsrv_run(lenv* e, char* path);
+
+/**
+ * Serialization
+ * 
+ */
+
+void lbuiltin_register(char* name, lbuiltin func);
+char* lbuiltin_name(lbuiltin func);
+lbuiltin lbuiltin_find(char* name);
+
+int lser_table_id(lser_table* t, void* k);
+void lser_put_bytes(lser_out* out, char* s, long n);
+void lser_put_uint(lser_out* out, unsigned long x);
+void lser_put_int(lser_out* out, long x);
+void lser_put_str(lser_out* out, char* s);
+void lser_put_sym(lser_out* out, char* sym);
+void lser_put_tag(lser_out* out, int tag);
+void lser_put_frames(lser_out* out, lenv* e);
+void lser_put_env(lser_out* out, lenv* e);
+void lser_put_lval(lser_out* out, lval* v);
+void lser_put_value(lser_out* out, lval* v);
+void lser_out_begin(lser_out* out, char* magic);
+void lser_out_end(lser_out* out);
+
+int lser_get_uint(lser_in* in, unsigned long* x);
+int lser_get_int(lser_in* in, long* x);
+char* lser_get_str(lser_in* in, long* n);
+char* lser_get_sym(lser_in* in);
+int lser_record(lser_in* in, lval* v, int done);
+int lser_get_env(lser_in* in, lenv* e);
+lval* lser_get_lval(lser_in* in);
+lval* lser_get_value(lser_in* in);
+int lser_in_begin(lser_in* in, char* magic, char* src, long n);
+void lser_in_end(lser_in* in);
+
+lval* limage_save(lenv* e, char* path);
+lval* limage_load(lenv* e, char* path);
 
 /**
  * Builtins
@@ -144,6 +629,16 @@ lval* builtin_put(lenv* e, lval* a);
 lval* builtin_var(lenv* e, lval* a, char* func);
 lval* builtin_exit(lenv* e, lval* a);
 lval* builtin_env(lenv* e, lval* a);
+lval* builtin_gc(lenv* e, lval* a);
+lval* builtin_pool(lenv* e, lval* a);
+lval* builtin_mem_stats(lenv* e, lval* a);
+void lstats_print(FILE* f);
+lval* builtin_max_depth(lenv* e, lval* a);
+lval* builtin_load(lenv* e, lval* a);
+lval* builtin_print(lenv* e, lval* a);
+lval* builtin_save_image(lenv* e, lval* a);
+lval* builtin_serialize(lenv* e, lval* a);
+lval* builtin_deserialize(lenv* e, lval* a);
 
 lval* builtin_head(lenv* e, lval* a);
 lval* builtin_tail(lenv* e, lval* a);
@@ -153,9 +648,14 @@ lval* builtin_join(lenv* e, lval* a);
 lval* builtin_cons(lenv* e, lval* a);
 lval* builtin_len(lenv* e, lval* a);
 lval* builtin_init(lenv* e, lval* a);
+lval* builtin_pmap(lenv* e, lval* a);
+lval* builtin_pfilter(lenv* e, lval* a);
+lval* builtin_preduce(lenv* e, lval* a);
+lval* builtin_spawn(lenv* e, lval* a);
+lval* builtin_await(lenv* e, lval* a);
 
 lval* builtin(lval* a, char* func);
-lval* builtin_op(lenv* e, lval* a, char* op);
+lval* builtin_op(lenv* e, lval* a, int op);
 lval* builtin_add(lenv* e, lval* a);
 lval* builtin_sub(lenv* e, lval* a);
 lval* builtin_mul(lenv* e, lval* a);
@@ -166,12 +666,12 @@ lval* builtin_max(lenv* e, lval* a);
 lval* builtin_min(lenv* e, lval* a);
 
 lval* builtin_if(lenv* e, lval* a);
-lval* builtin_ord(lenv* e, lval* a, char* op);
+lval* builtin_ord(lenv* e, lval* a, int op);
 lval* builtin_gt(lenv* e, lval* a);
 lval* builtin_lt(lenv* e, lval* a);
 lval* builtin_ge(lenv* e, lval* a);
 lval* builtin_le(lenv* e, lval* a);
-lval* builtin_cmp(lenv* e, lval* a, char* op);
+lval* builtin_cmp(lenv* e, lval* a, int op);
 lval* builtin_eq(lenv* e, lval* a);
 lval* builtin_ne(lenv* e, lval* a);
 // TODO: ||, &&, !